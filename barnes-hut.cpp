@@ -0,0 +1,582 @@
+////////////////////////////////////////////////////////////////////////////////
+//3456789 123456789 123456789 123456789 123456789 123456789 123456789 123456789
+//
+// A test trying out OpenGL 3.x's transform-feedback feature with some SDL2.x
+// glue code to make it work on multiple platforms
+//
+// Copyright 2015-2016 Mirco Müller
+//
+// Author(s):
+//   Mirco "MacSlow" Müller <macslow@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cmath>
+
+#if (defined __x86_64__ || defined __i386__) && defined __GNUC__
+#define HAVE_X86_SIMD
+#endif
+
+#include "barnes-hut.h"
+#include "radix-sort.h"
+
+// bits per axis of the Morton-codes, cells go down to 1/65536 of the volume
+#define MORTON_BITS 16
+
+// cells with at most this many particles aren't split any further
+#define LEAF_SIZE 16
+
+// the 8^3 cells of this level are built as independent subtrees in parallel
+#define SUBTREE_LEVEL 3
+
+// don't bother threads with less than this many particles at a time
+#define MIN_CHUNK_SIZE 16384
+
+// leaves handed out at a time for the force-evaluation
+#define LEAVES_PER_CHUNK 16
+
+// keeps close encounters (and a particle with itself) finite
+#define SOFTENING 0.0001f
+
+// spreads the lower 16 bits of v out to every third bit
+static uint64_t spreadBits (uint64_t v)
+{
+    v &= 0xffff;
+    v = (v | (v << 16)) & 0x0000ff0000ffULL;
+    v = (v | (v << 8)) & 0x00f00f00f00fULL;
+    v = (v | (v << 4)) & 0x0c30c30c30c3ULL;
+    v = (v | (v << 2)) & 0x249249249249ULL;
+    return v;
+}
+
+typedef void (*InteractionKernel) (const float* x,
+                                   const float* y,
+                                   const float* z,
+                                   const float* m,
+                                   size_t count,
+                                   const float* position,
+                                   float* acceleration);
+
+// the pull of count point-masses on a particle at position, written plainly
+// so the compiler vectorizes it for whatever target it gets inlined into
+static inline __attribute__ ((always_inline))
+void sumInteractions (const float* x,
+                      const float* y,
+                      const float* z,
+                      const float* m,
+                      size_t count,
+                      const float* position,
+                      float* acceleration)
+{
+    float ax = 0.0f;
+    float ay = 0.0f;
+    float az = 0.0f;
+    for (size_t j = 0; j < count; ++j) {
+        float dx = x[j] - position[0];
+        float dy = y[j] - position[1];
+        float dz = z[j] - position[2];
+        float r2 = dx * dx + dy * dy + dz * dz + SOFTENING;
+        float inv = 1.0f / std::sqrt (r2);
+        float s = m[j] * inv * inv * inv;
+        ax += dx * s;
+        ay += dy * s;
+        az += dz * s;
+    }
+    acceleration[0] = ax;
+    acceleration[1] = ay;
+    acceleration[2] = az;
+}
+
+static void sumInteractionsDefault (const float* x,
+                                    const float* y,
+                                    const float* z,
+                                    const float* m,
+                                    size_t count,
+                                    const float* position,
+                                    float* acceleration)
+{
+    sumInteractions (x, y, z, m, count, position, acceleration);
+}
+
+#if defined HAVE_X86_SIMD
+
+__attribute__ ((target ("avx2,fma")))
+static void sumInteractionsAVX2 (const float* x,
+                                 const float* y,
+                                 const float* z,
+                                 const float* m,
+                                 size_t count,
+                                 const float* position,
+                                 float* acceleration)
+{
+    sumInteractions (x, y, z, m, count, position, acceleration);
+}
+
+__attribute__ ((target ("avx512f")))
+static void sumInteractionsAVX512 (const float* x,
+                                   const float* y,
+                                   const float* z,
+                                   const float* m,
+                                   size_t count,
+                                   const float* position,
+                                   float* acceleration)
+{
+    sumInteractions (x, y, z, m, count, position, acceleration);
+}
+
+#endif // HAVE_X86_SIMD
+
+static InteractionKernel selectInteractionKernel ()
+{
+#if defined HAVE_X86_SIMD
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx512f")) {
+        return sumInteractionsAVX512;
+    } else if (__builtin_cpu_supports ("avx2") &&
+               __builtin_cpu_supports ("fma")) {
+        return sumInteractionsAVX2;
+    }
+#endif
+
+    return sumInteractionsDefault;
+}
+
+static size_t chunkSizeFor (ThreadPool& pool, size_t count)
+{
+    size_t chunkSize = count / (pool.size () * 4) + 1;
+    return chunkSize < MIN_CHUNK_SIZE ? MIN_CHUNK_SIZE : chunkSize;
+}
+
+BarnesHut::BarnesHut (float theta) :
+    _theta (theta),
+    _bodyMass (0.0f),
+    _extent (0.0f),
+    _origin {0.0f, 0.0f, 0.0f},
+    _scale {0.0f, 0.0f, 0.0f}
+{
+}
+
+void BarnesHut::setTheta (float theta)
+{
+    _theta = theta;
+}
+
+float BarnesHut::theta () const
+{
+    return _theta;
+}
+
+size_t BarnesHut::numNodes () const
+{
+    return _nodes.size ();
+}
+
+// sorts the particles by their Morton-codes, _order is the permutation
+void BarnesHut::sortByMortonCode (ThreadPool& pool,
+                                  const ParticleArrays& arrays)
+{
+    size_t count = arrays.count;
+    size_t chunkSize = chunkSizeFor (pool, count);
+
+    _codes.resize (count);
+    _codesTmp.resize (count);
+    _order.resize (count);
+    _orderTmp.resize (count);
+
+    pool.parallelFor (count, chunkSize, [&] (size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            float position[3] = {arrays.x[i], arrays.y[i], arrays.z[i]};
+            uint64_t code = 0;
+            for (int c = 0; c < 3; ++c) {
+                float cell = (position[c] - _origin[c]) * _scale[c];
+                cell = std::min (std::max (cell, 0.0f), 65535.0f);
+                code |= spreadBits ((uint64_t) cell) << (2 - c);
+            }
+            _codes[i] = code;
+            _order[i] = (uint32_t) i;
+        }
+    });
+
+    radixSort (pool,
+               chunkSize,
+               3 * MORTON_BITS,
+               _codes,
+               _codesTmp,
+               _order,
+               _orderTmp,
+               _histograms);
+
+    // positions in Morton-order, that's what the tree and the forces use
+    _x.resize (count);
+    _y.resize (count);
+    _z.resize (count);
+    pool.parallelFor (count, chunkSize, [&] (size_t begin, size_t end) {
+        for (size_t k = begin; k < end; ++k) {
+            uint32_t i = _order[k];
+            _x[k] = arrays.x[i];
+            _y[k] = arrays.y[i];
+            _z[k] = arrays.z[i];
+        }
+    });
+}
+
+// first particle in [begin, end) of a cell at level that doesn't belong into
+// its children up to octant anymore, the codes are sorted so it's a bisection
+uint32_t BarnesHut::splitOctant (unsigned int level,
+                                 unsigned int octant,
+                                 uint32_t begin,
+                                 uint32_t end) const
+{
+    unsigned int shift = 3 * (MORTON_BITS - level - 1);
+    auto split = std::partition_point (_codes.begin () + begin,
+                                       _codes.begin () + end,
+                                       [&] (uint64_t code) {
+                                           return ((code >> shift) & 7) <=
+                                                  octant;
+                                       });
+    return (uint32_t) (split - _codes.begin ());
+}
+
+void BarnesHut::finishNode (Node& node, const std::vector<Node>& nodes) const
+{
+    float center[3] = {0.0f, 0.0f, 0.0f};
+    float mass = 0.0f;
+    for (uint32_t c = 0; c < node.numChildren; ++c) {
+        const Node& child = nodes[node.children[c]];
+        for (int i = 0; i < 3; ++i) {
+            center[i] += child.mass * child.center[i];
+        }
+        mass += child.mass;
+    }
+
+    for (int i = 0; i < 3; ++i) {
+        node.center[i] = mass != 0.0f ? center[i] / mass : 0.0f;
+    }
+    node.mass = mass;
+}
+
+// builds the cell bottom-up, children are appended before their parent and
+// its mass and center are gathered from them once they're done
+uint32_t BarnesHut::buildNode (std::vector<Node>& nodes,
+                               unsigned int level,
+                               uint32_t begin,
+                               uint32_t end) const
+{
+    Node node;
+    node.size = std::ldexp (_extent, -(int) level);
+    node.begin = begin;
+    node.end = end;
+    node.numChildren = 0;
+
+    if (end - begin <= LEAF_SIZE || level == MORTON_BITS) {
+        float center[3] = {0.0f, 0.0f, 0.0f};
+        for (uint32_t i = begin; i < end; ++i) {
+            center[0] += _x[i];
+            center[1] += _y[i];
+            center[2] += _z[i];
+        }
+        for (int i = 0; i < 3; ++i) {
+            node.center[i] = center[i] / (end - begin);
+        }
+        node.mass = (end - begin) * _bodyMass;
+    } else {
+        uint32_t first = begin;
+        for (unsigned int octant = 0; octant < 8; ++octant) {
+            uint32_t last = splitOctant (level, octant, first, end);
+            if (last > first) {
+                node.children[node.numChildren++] = buildNode (nodes,
+                                                               level + 1,
+                                                               first,
+                                                               last);
+            }
+            first = last;
+        }
+        finishNode (node, nodes);
+    }
+
+    nodes.push_back (node);
+    return (uint32_t) (nodes.size () - 1);
+}
+
+void BarnesHut::collectSubtrees (unsigned int level,
+                                 uint32_t begin,
+                                 uint32_t end)
+{
+    if (level == SUBTREE_LEVEL) {
+        _subtreeRanges.push_back (std::make_pair (begin, end));
+        return;
+    }
+
+    uint32_t first = begin;
+    for (unsigned int octant = 0; octant < 8; ++octant) {
+        uint32_t last = splitOctant (level, octant, first, end);
+        if (last > first) {
+            collectSubtrees (level + 1, first, last);
+        }
+        first = last;
+    }
+}
+
+// the levels above the subtrees, visits the cells in the same order as
+// collectSubtrees() did
+uint32_t BarnesHut::buildTop (unsigned int level,
+                              uint32_t begin,
+                              uint32_t end,
+                              size_t& subtree)
+{
+    if (level == SUBTREE_LEVEL) {
+        uint32_t root = (uint32_t) (_subtreeOffsets[subtree] +
+                                    _subtrees[subtree].size () - 1);
+        ++subtree;
+        return root;
+    }
+
+    Node node;
+    node.size = std::ldexp (_extent, -(int) level);
+    node.begin = begin;
+    node.end = end;
+    node.numChildren = 0;
+
+    uint32_t first = begin;
+    for (unsigned int octant = 0; octant < 8; ++octant) {
+        uint32_t last = splitOctant (level, octant, first, end);
+        if (last > first) {
+            node.children[node.numChildren++] = buildTop (level + 1,
+                                                          first,
+                                                          last,
+                                                          subtree);
+        }
+        first = last;
+    }
+    finishNode (node, _nodes);
+
+    _nodes.push_back (node);
+    return (uint32_t) (_nodes.size () - 1);
+}
+
+void BarnesHut::buildTree (ThreadPool& pool)
+{
+    uint32_t count = (uint32_t) _codes.size ();
+
+    _subtreeRanges.clear ();
+    collectSubtrees (0, 0, count);
+
+    size_t numSubtrees = _subtreeRanges.size ();
+    _subtrees.resize (numSubtrees);
+    pool.parallelFor (numSubtrees, 1, [&] (size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            _subtrees[i].clear ();
+            buildNode (_subtrees[i],
+                       SUBTREE_LEVEL,
+                       _subtreeRanges[i].first,
+                       _subtreeRanges[i].second);
+        }
+    });
+
+    // stitch all subtrees into one array, their child-indices move along
+    _subtreeOffsets.resize (numSubtrees);
+    size_t numNodes = 0;
+    for (size_t i = 0; i < numSubtrees; ++i) {
+        _subtreeOffsets[i] = numNodes;
+        numNodes += _subtrees[i].size ();
+    }
+
+    _nodes.resize (numNodes);
+    pool.parallelFor (numSubtrees, 1, [&] (size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            uint32_t offset = (uint32_t) _subtreeOffsets[i];
+            for (size_t n = 0; n < _subtrees[i].size (); ++n) {
+                Node node = _subtrees[i][n];
+                for (uint32_t c = 0; c < node.numChildren; ++c) {
+                    node.children[c] += offset;
+                }
+                _nodes[offset + n] = node;
+            }
+        }
+    });
+
+    size_t subtree = 0;
+    buildTop (0, 0, count, subtree);
+
+    _leaves.clear ();
+    for (size_t n = 0; n < _nodes.size (); ++n) {
+        if (_nodes[n].numChildren == 0) {
+            _leaves.push_back ((uint32_t) n);
+        }
+    }
+}
+
+// walks the tree once per leaf for all its particles, the opening-criterion
+// uses the distance to the leaf's bounding-box so it holds for every one of
+// them, then sums up the resulting list of point-masses per particle
+void BarnesHut::accelerate (ThreadPool& pool)
+{
+    uint32_t root = (uint32_t) (_nodes.size () - 1);
+    float theta2 = _theta * _theta;
+    float factor = GRAVITY_G * PARTICLE_MASS * PARTICLE_MASS;
+    static const InteractionKernel kernel = selectInteractionKernel ();
+
+    _ax.resize (_codes.size ());
+    _ay.resize (_codes.size ());
+    _az.resize (_codes.size ());
+
+    pool.parallelFor (_leaves.size (),
+                      LEAVES_PER_CHUNK,
+                      [&] (size_t begin, size_t end) {
+        std::vector<uint32_t> stack;
+        std::vector<float> x;
+        std::vector<float> y;
+        std::vector<float> z;
+        std::vector<float> m;
+
+        for (size_t l = begin; l < end; ++l) {
+            const Node& leaf = _nodes[_leaves[l]];
+            float low[3] = {_x[leaf.begin], _y[leaf.begin], _z[leaf.begin]};
+            float high[3] = {low[0], low[1], low[2]};
+            for (uint32_t i = leaf.begin + 1; i < leaf.end; ++i) {
+                low[0] = std::min (low[0], _x[i]);
+                low[1] = std::min (low[1], _y[i]);
+                low[2] = std::min (low[2], _z[i]);
+                high[0] = std::max (high[0], _x[i]);
+                high[1] = std::max (high[1], _y[i]);
+                high[2] = std::max (high[2], _z[i]);
+            }
+
+            x.clear ();
+            y.clear ();
+            z.clear ();
+            m.clear ();
+            stack.assign (1, root);
+            while (!stack.empty ()) {
+                const Node& node = _nodes[stack.back ()];
+                stack.pop_back ();
+
+                if (node.numChildren == 0) {
+                    x.insert (x.end (), &_x[node.begin], &_x[node.end - 1] + 1);
+                    y.insert (y.end (), &_y[node.begin], &_y[node.end - 1] + 1);
+                    z.insert (z.end (), &_z[node.begin], &_z[node.end - 1] + 1);
+                    m.insert (m.end (), node.end - node.begin, _bodyMass);
+                    continue;
+                }
+
+                float distance2 = 0.0f;
+                for (int c = 0; c < 3; ++c) {
+                    float below = low[c] - node.center[c];
+                    float above = node.center[c] - high[c];
+                    float outside = std::max (std::max (below, above), 0.0f);
+                    distance2 += outside * outside;
+                }
+
+                // a cell holding the leaf's own particles is always opened,
+                // for theta > 1/sqrt(3) its center of mass could otherwise
+                // pass the test and the particles would pull on themselves
+                bool ownCell = node.begin <= leaf.begin &&
+                               leaf.end <= node.end;
+                if (!ownCell && node.size * node.size < theta2 * distance2) {
+                    x.push_back (node.center[0]);
+                    y.push_back (node.center[1]);
+                    z.push_back (node.center[2]);
+                    m.push_back (node.mass);
+                    continue;
+                }
+
+                stack.insert (stack.end (),
+                              node.children,
+                              node.children + node.numChildren);
+            }
+
+            for (uint32_t i = leaf.begin; i < leaf.end; ++i) {
+                float position[3] = {_x[i], _y[i], _z[i]};
+                float acceleration[3];
+                kernel (x.data (),
+                        y.data (),
+                        z.data (),
+                        m.data (),
+                        m.size (),
+                        position,
+                        acceleration);
+                _ax[i] = factor * acceleration[0];
+                _ay[i] = factor * acceleration[1];
+                _az[i] = factor * acceleration[2];
+            }
+        }
+    });
+}
+
+void BarnesHut::step (ThreadPool& pool,
+                      ParticleArrays& arrays,
+                      const GravityParams& params,
+                      float bodyMass)
+{
+    if (arrays.count == 0) {
+        return;
+    }
+
+    _bodyMass = bodyMass;
+    _extent = 0.0f;
+    for (int c = 0; c < 3; ++c) {
+        _origin[c] = -params.limits[c];
+        _scale[c] = 65536.0f / (2.0f * params.limits[c]);
+        _extent = std::max (_extent, 2.0f * params.limits[c]);
+    }
+
+    sortByMortonCode (pool, arrays);
+    buildTree (pool);
+    accelerate (pool);
+
+    // same as stepGravityScalar() plus the particles' pull on each other
+    const float k = GRAVITY_G * PARTICLE_MASS * params.blackHoleMass;
+    const float* bh = params.blackHolePosition;
+    const float* limits = params.limits;
+    float* pos[3] = {arrays.x, arrays.y, arrays.z};
+    float* vel[3] = {arrays.vx, arrays.vy, arrays.vz};
+    pool.parallelFor (arrays.count,
+                      chunkSizeFor (pool, arrays.count),
+                      [&] (size_t begin, size_t end) {
+        for (size_t n = begin; n < end; ++n) {
+            uint32_t i = _order[n];
+            float acceleration[3] = {_ax[n], _ay[n], _az[n]};
+            float p[3] = {bh[0] - pos[0][i],
+                          bh[1] - pos[1][i],
+                          bh[2] - pos[2][i]};
+            float dist = std::sqrt (p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+            float d = dist * dist;
+            float scale = PARTICLE_MASS * k / (dist * d);
+
+            bool outside = false;
+            float tmp[3];
+            for (int c = 0; c < 3; ++c) {
+                float newVelocity = scale * p[c] + acceleration[c] + vel[c][i];
+                tmp[c] = .475f * (vel[c][i] + newVelocity);
+                float newPosition = pos[c][i] + tmp[c] * params.timeStep;
+                if (newPosition <= -limits[c]) {
+                    newPosition = limits[c];
+                    outside = true;
+                } else if (newPosition >= limits[c]) {
+                    newPosition = -limits[c];
+                    outside = true;
+                }
+                pos[c][i] = newPosition;
+            }
+
+            float damping = outside ? 0.1f : 1.0f;
+            for (int c = 0; c < 3; ++c) {
+                vel[c][i] = damping * tmp[c];
+            }
+            arrays.distance[i] = dist;
+        }
+    });
+}
@@ -0,0 +1,110 @@
+////////////////////////////////////////////////////////////////////////////////
+//3456789 123456789 123456789 123456789 123456789 123456789 123456789 123456789
+//
+// A test trying out OpenGL 3.x's transform-feedback feature with some SDL2.x
+// glue code to make it work on multiple platforms
+//
+// Copyright 2015-2016 Mirco Müller
+//
+// Author(s):
+//   Mirco "MacSlow" Müller <macslow@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _BARNES_HUT_H
+#define _BARNES_HUT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "cpu-simulation.h"
+#include "thread-pool.h"
+
+// True n-body gravity between all particles in O(N log N). Every step sorts
+// the particles along a Morton-curve, builds an octree over them in parallel
+// and lets each leaf's particles interact with every cell that looks small
+// enough from there (cell-size < theta * distance) as a single point-mass,
+// the rest directly. The black-hole is added on top, integration and
+// wrap-around are the same as stepGravity()'s.
+class BarnesHut
+{
+    public:
+        explicit BarnesHut (float theta = 0.5f);
+
+        void setTheta (float theta);
+        float theta () const;
+        size_t numNodes () const;
+
+        // bodyMass is every particle's mass in the same units as the
+        // black-hole's
+        void step (ThreadPool& pool,
+                   ParticleArrays& arrays,
+                   const GravityParams& params,
+                   float bodyMass);
+
+    private:
+        struct Node {
+            float center[3]; // center of mass
+            float mass;
+            float size;      // edge-length of the cell
+            uint32_t begin;  // first and one past the last sorted particle
+            uint32_t end;
+            uint32_t numChildren;
+            uint32_t children[8];
+        };
+
+        void sortByMortonCode (ThreadPool& pool, const ParticleArrays& arrays);
+        void buildTree (ThreadPool& pool);
+        uint32_t buildNode (std::vector<Node>& nodes,
+                            unsigned int level,
+                            uint32_t begin,
+                            uint32_t end) const;
+        uint32_t buildTop (unsigned int level,
+                           uint32_t begin,
+                           uint32_t end,
+                           size_t& subtree);
+        void collectSubtrees (unsigned int level, uint32_t begin, uint32_t end);
+        uint32_t splitOctant (unsigned int level,
+                              unsigned int octant,
+                              uint32_t begin,
+                              uint32_t end) const;
+        void finishNode (Node& node, const std::vector<Node>& nodes) const;
+        void accelerate (ThreadPool& pool);
+
+        float _theta;
+        float _bodyMass;
+        float _extent;
+        float _origin[3];
+        float _scale[3];
+        std::vector<uint64_t> _codes;
+        std::vector<uint64_t> _codesTmp;
+        std::vector<uint32_t> _order;
+        std::vector<uint32_t> _orderTmp;
+        std::vector<uint32_t> _histograms;
+        std::vector<float> _x;
+        std::vector<float> _y;
+        std::vector<float> _z;
+        std::vector<float> _ax;
+        std::vector<float> _ay;
+        std::vector<float> _az;
+        std::vector<Node> _nodes;
+        std::vector<uint32_t> _leaves;
+        std::vector<std::pair<uint32_t, uint32_t> > _subtreeRanges;
+        std::vector<std::vector<Node> > _subtrees;
+        std::vector<size_t> _subtreeOffsets;
+};
+
+#endif // _BARNES_HUT_H
@@ -0,0 +1,236 @@
+////////////////////////////////////////////////////////////////////////////////
+//3456789 123456789 123456789 123456789 123456789 123456789 123456789 123456789
+//
+// A test trying out OpenGL 3.x's transform-feedback feature with some SDL2.x
+// glue code to make it work on multiple platforms
+//
+// Copyright 2015-2016 Mirco Müller
+//
+// Author(s):
+//   Mirco "MacSlow" Müller <macslow@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// Sweeps particle-count, layout and backend by running the headless-mode of
+// transform-feedback_release once per combination and collects the JSON each
+// run reports into one document. Every combination gets its own process, so
+// the reported peak RSS really belongs to that combination alone.
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define DEFAULT_BINARY        "./transform-feedback_release"
+#define DEFAULT_MIN_PARTICLES (64 * 1024)
+#define DEFAULT_MAX_PARTICLES (16 * 1024 * 1024)
+#define DEFAULT_STEPS         20
+#define DEFAULT_WARMUP        3
+#define DEFAULT_REPEAT        5
+
+std::vector<std::string> split (const std::string& list)
+{
+    std::vector<std::string> items;
+    std::stringstream stream (list);
+    std::string item;
+    while (std::getline (stream, item, ',')) {
+        if (!item.empty ()) {
+            items.push_back (item);
+        }
+    }
+
+    return items;
+}
+
+// runs the binary with args and hands back the last line of its output which
+// looks like a JSON-object, an empty string on any failure
+std::string runHeadless (const std::string& binary,
+                         const std::vector<std::string>& args,
+                         int* status)
+{
+    int fds[2];
+    if (pipe (fds) != 0) {
+        *status = -1;
+        return std::string ();
+    }
+
+    pid_t pid = fork ();
+    if (pid < 0) {
+        close (fds[0]);
+        close (fds[1]);
+        *status = -1;
+        return std::string ();
+    }
+
+    if (pid == 0) {
+        std::vector<char*> argv;
+        argv.push_back (const_cast<char*> (binary.c_str ()));
+        for (const std::string& arg : args) {
+            argv.push_back (const_cast<char*> (arg.c_str ()));
+        }
+        argv.push_back (nullptr);
+
+        dup2 (fds[1], STDOUT_FILENO);
+        close (fds[0]);
+        close (fds[1]);
+        execv (binary.c_str (), argv.data ());
+        _exit (127);
+    }
+
+    close (fds[1]);
+    std::string output;
+    char buffer[4096];
+    ssize_t bytes = 0;
+    while ((bytes = read (fds[0], buffer, sizeof (buffer))) > 0) {
+        output.append (buffer, (size_t) bytes);
+    }
+    close (fds[0]);
+
+    int wstatus = 0;
+    waitpid (pid, &wstatus, 0);
+    *status = WIFEXITED (wstatus) ? WEXITSTATUS (wstatus) : -1;
+
+    std::string result;
+    std::stringstream lines (output);
+    std::string line;
+    while (std::getline (lines, line)) {
+        if (!line.empty () && line[0] == '{') {
+            result = line;
+        }
+    }
+
+    return *status == 0 ? result : std::string ();
+}
+
+int main (int argc, char* argv[])
+{
+    std::string binary (DEFAULT_BINARY);
+    size_t minParticles = DEFAULT_MIN_PARTICLES;
+    size_t maxParticles = DEFAULT_MAX_PARTICLES;
+    unsigned int steps = DEFAULT_STEPS;
+    unsigned int warmup = DEFAULT_WARMUP;
+    unsigned int repeat = DEFAULT_REPEAT;
+    std::vector<std::string> backends = split ("gpu,cpu");
+    std::vector<std::string> layouts = split ("float,packed");
+    std::string outputFile;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg (argv[i]);
+        if (arg == "--binary" && i + 1 < argc) {
+            binary = argv[++i];
+        } else if (arg == "--min-particles" && i + 1 < argc) {
+            minParticles = (size_t) strtoull (argv[++i], nullptr, 10);
+        } else if (arg == "--max-particles" && i + 1 < argc) {
+            maxParticles = (size_t) strtoull (argv[++i], nullptr, 10);
+        } else if (arg == "--steps" && i + 1 < argc) {
+            steps = (unsigned int) atoi (argv[++i]);
+        } else if (arg == "--warmup" && i + 1 < argc) {
+            warmup = (unsigned int) atoi (argv[++i]);
+        } else if (arg == "--repeat" && i + 1 < argc) {
+            repeat = (unsigned int) atoi (argv[++i]);
+        } else if (arg == "--backends" && i + 1 < argc) {
+            backends = split (argv[++i]);
+        } else if (arg == "--layouts" && i + 1 < argc) {
+            layouts = split (argv[++i]);
+        } else if (arg == "--output" && i + 1 < argc) {
+            outputFile = argv[++i];
+        } else {
+            std::cout << "Unknown argument " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    if (minParticles == 0 || minParticles > maxParticles) {
+        std::cout << "Need 0 < --min-particles <= --max-particles"
+                  << std::endl;
+        return 1;
+    }
+
+    std::stringstream json;
+    json << "{\n  \"binary\": \"" << binary << "\",\n"
+         << "  \"hardwareThreads\": " << std::thread::hardware_concurrency ()
+         << ",\n  \"steps\": " << steps << ",\n"
+         << "  \"warmupSteps\": " << warmup << ",\n"
+         << "  \"repetitions\": " << repeat << ",\n"
+         << "  \"runs\": [";
+
+    bool first = true;
+    for (const std::string& backend : backends) {
+        for (const std::string& layout : layouts) {
+            // the CPU-backend only knows the float-layout
+            if (backend != "gpu" && layout != "float") {
+                continue;
+            }
+
+            for (size_t count = minParticles;
+                 count <= maxParticles;
+                 count *= 4) {
+                std::cerr << backend << ", " << layout << "-layout, " << count
+                          << " particles..." << std::endl;
+
+                std::vector<std::string> args;
+                args.push_back ("--headless");
+                args.push_back (std::to_string (steps));
+                args.push_back ("--backend");
+                args.push_back (backend);
+                args.push_back ("--layout");
+                args.push_back (layout);
+                args.push_back ("--particles");
+                args.push_back (std::to_string (count));
+                args.push_back ("--warmup");
+                args.push_back (std::to_string (warmup));
+                args.push_back ("--repeat");
+                args.push_back (std::to_string (repeat));
+                args.push_back ("--json");
+
+                int status = 0;
+                std::string run = runHeadless (binary, args, &status);
+                json << (first ? "\n    " : ",\n    ");
+                first = false;
+                if (run.empty ()) {
+                    // keep failed combinations visible, e.g. out of memory
+                    json << "{\"backend\": \"" << backend << "\", "
+                         << "\"layout\": \"" << layout << "\", "
+                         << "\"particles\": " << count << ", "
+                         << "\"error\": \"exit status " << status << "\"}";
+                } else {
+                    json << run;
+                }
+            }
+        }
+    }
+    json << "\n  ]\n}\n";
+
+    if (outputFile.empty ()) {
+        std::cout << json.str ();
+        return 0;
+    }
+
+    std::ofstream file (outputFile);
+    if (!file || !(file << json.str ())) {
+        std::cout << "Failed to write benchmark-results to " << outputFile
+                  << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,268 @@
+////////////////////////////////////////////////////////////////////////////////
+//3456789 123456789 123456789 123456789 123456789 123456789 123456789 123456789
+//
+// A test trying out OpenGL 3.x's transform-feedback feature with some SDL2.x
+// glue code to make it work on multiple platforms
+//
+// Copyright 2015-2016 Mirco Müller
+//
+// Author(s):
+//   Mirco "MacSlow" Müller <macslow@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+
+// big enough to keep the driver busy, small enough to not pile up in memory
+#define CHECKPOINT_CHUNK_SIZE (64 * 1024 * 1024)
+
+static_assert (sizeof (CheckpointHeader) <= CHECKPOINT_DATA_OFFSET,
+               "checkpoint-header has to fit in front of the particle-data");
+
+Checkpoint::Checkpoint ()
+    : _fd (-1)
+    , _writable (false)
+    , _map (nullptr)
+    , _mapSize (0)
+{
+    std::memset (&_header, 0, sizeof (_header));
+}
+
+Checkpoint::~Checkpoint ()
+{
+    close ();
+}
+
+bool Checkpoint::create (const char* filename, const CheckpointHeader& header)
+{
+    close ();
+
+    size_t bytes = (size_t) header.numParticles * header.bytesPerParticle;
+    if (header.bytesPerParticle == 0 ||
+        bytes / header.bytesPerParticle != header.numParticles) {
+        std::cout << "Invalid checkpoint-size for " << header.numParticles
+                  << " particles" << std::endl;
+        return false;
+    }
+
+    _fd = ::open (filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (_fd < 0) {
+        std::cout << "Failed to create checkpoint " << filename << ": "
+                  << std::strerror (errno) << std::endl;
+        return false;
+    }
+
+    _mapSize = CHECKPOINT_DATA_OFFSET + bytes;
+    if (ftruncate (_fd, (off_t) _mapSize) != 0) {
+        std::cout << "Failed to size checkpoint " << filename << ": "
+                  << std::strerror (errno) << std::endl;
+        close ();
+        return false;
+    }
+
+    void* map = mmap (nullptr,
+                      _mapSize,
+                      PROT_READ | PROT_WRITE,
+                      MAP_SHARED,
+                      _fd,
+                      0);
+    if (map == MAP_FAILED) {
+        std::cout << "Failed to map checkpoint " << filename << ": "
+                  << std::strerror (errno) << std::endl;
+        close ();
+        return false;
+    }
+
+    _map = (unsigned char*) map;
+    _writable = true;
+    _header = header;
+    std::memcpy (_header.magic, CHECKPOINT_MAGIC, sizeof (_header.magic));
+    _header.version = CHECKPOINT_VERSION;
+    std::memcpy (_map, &_header, sizeof (_header));
+
+    return true;
+}
+
+bool Checkpoint::open (const char* filename)
+{
+    close ();
+
+    _fd = ::open (filename, O_RDONLY);
+    if (_fd < 0) {
+        std::cout << "Failed to open checkpoint " << filename << ": "
+                  << std::strerror (errno) << std::endl;
+        return false;
+    }
+
+    struct stat info;
+    if (fstat (_fd, &info) != 0 ||
+        (size_t) info.st_size < CHECKPOINT_DATA_OFFSET) {
+        std::cout << filename << " is no checkpoint" << std::endl;
+        close ();
+        return false;
+    }
+
+    _mapSize = (size_t) info.st_size;
+    void* map = mmap (nullptr, _mapSize, PROT_READ, MAP_PRIVATE, _fd, 0);
+    if (map == MAP_FAILED) {
+        std::cout << "Failed to map checkpoint " << filename << ": "
+                  << std::strerror (errno) << std::endl;
+        _mapSize = 0;
+        close ();
+        return false;
+    }
+    _map = (unsigned char*) map;
+
+    std::memcpy (&_header, _map, sizeof (_header));
+    size_t bytes = (size_t) _header.numParticles * _header.bytesPerParticle;
+    if (std::memcmp (_header.magic, CHECKPOINT_MAGIC, sizeof (_header.magic)) ||
+        _header.version != CHECKPOINT_VERSION) {
+        std::cout << filename << " is no checkpoint of this version"
+                  << std::endl;
+        close ();
+        return false;
+    }
+    if (_header.bytesPerParticle == 0 ||
+        bytes / _header.bytesPerParticle != _header.numParticles ||
+        CHECKPOINT_DATA_OFFSET + bytes != _mapSize) {
+        std::cout << "Checkpoint " << filename << " is truncated or corrupt"
+                  << std::endl;
+        close ();
+        return false;
+    }
+
+    // the data is read front to back exactly once
+    madvise (_map, _mapSize, MADV_SEQUENTIAL);
+
+    return true;
+}
+
+bool Checkpoint::close ()
+{
+    bool success = true;
+    if (_map) {
+        if (_writable && msync (_map, _mapSize, MS_SYNC) != 0) {
+            std::cout << "Failed to write checkpoint: "
+                      << std::strerror (errno) << std::endl;
+            success = false;
+        }
+        munmap (_map, _mapSize);
+    }
+    if (_fd >= 0) {
+        ::close (_fd);
+    }
+
+    _fd = -1;
+    _writable = false;
+    _map = nullptr;
+    _mapSize = 0;
+
+    return success;
+}
+
+const CheckpointHeader& Checkpoint::header () const
+{
+    return _header;
+}
+
+void* Checkpoint::particles () const
+{
+    return _map ? _map + CHECKPOINT_DATA_OFFSET : nullptr;
+}
+
+size_t Checkpoint::particleBytes () const
+{
+    return _map ? _mapSize - CHECKPOINT_DATA_OFFSET : 0;
+}
+
+bool Checkpoint::download (GLuint buffer)
+{
+    if (!_map || !_writable) {
+        return false;
+    }
+
+    bool success = true;
+    size_t bytes = particleBytes ();
+    glBindBuffer (GL_ARRAY_BUFFER, buffer);
+    for (size_t offset = 0; offset < bytes; offset += CHECKPOINT_CHUNK_SIZE) {
+        size_t size = std::min (bytes - offset,
+                                (size_t) CHECKPOINT_CHUNK_SIZE);
+        const void* mapped = glMapBufferRange (GL_ARRAY_BUFFER,
+                                               (GLintptr) offset,
+                                               (GLsizeiptr) size,
+                                               GL_MAP_READ_BIT);
+        if (!mapped) {
+            std::cout << "Failed to map particle-buffer for the checkpoint"
+                      << std::endl;
+            success = false;
+            break;
+        }
+        std::memcpy ((unsigned char*) particles () + offset, mapped, size);
+        glUnmapBuffer (GL_ARRAY_BUFFER);
+        release (CHECKPOINT_DATA_OFFSET + offset, size);
+    }
+    glBindBuffer (GL_ARRAY_BUFFER, 0);
+
+    return success;
+}
+
+bool Checkpoint::upload (GLuint buffer)
+{
+    if (!_map || _writable) {
+        return false;
+    }
+
+    size_t bytes = particleBytes ();
+    glBindBuffer (GL_ARRAY_BUFFER, buffer);
+    for (size_t offset = 0; offset < bytes; offset += CHECKPOINT_CHUNK_SIZE) {
+        size_t size = std::min (bytes - offset,
+                                (size_t) CHECKPOINT_CHUNK_SIZE);
+        glBufferSubData (GL_ARRAY_BUFFER,
+                         (GLintptr) offset,
+                         (GLsizeiptr) size,
+                         (const unsigned char*) particles () + offset);
+        release (CHECKPOINT_DATA_OFFSET + offset, size);
+    }
+    glBindBuffer (GL_ARRAY_BUFFER, 0);
+
+    return true;
+}
+
+// drops the pages of a finished chunk from this process, for a created file
+// they stay dirty in the page-cache until written back
+void Checkpoint::release (size_t offset, size_t size)
+{
+    size_t page = (size_t) sysconf (_SC_PAGESIZE);
+    size_t begin = offset / page * page;
+    size_t end = (offset + size) / page * page;
+    if (end <= begin) {
+        return;
+    }
+
+    if (_writable) {
+        msync (_map + begin, end - begin, MS_ASYNC);
+    }
+    madvise (_map + begin, end - begin, MADV_DONTNEED);
+}
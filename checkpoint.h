@@ -0,0 +1,96 @@
+////////////////////////////////////////////////////////////////////////////////
+//3456789 123456789 123456789 123456789 123456789 123456789 123456789 123456789
+//
+// A test trying out OpenGL 3.x's transform-feedback feature with some SDL2.x
+// glue code to make it work on multiple platforms
+//
+// Copyright 2015-2016 Mirco Müller
+//
+// Author(s):
+//   Mirco "MacSlow" Müller <macslow@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _CHECKPOINT_H
+#define _CHECKPOINT_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <GL/glew.h>
+
+#define CHECKPOINT_MAGIC   "TFCKPT1"
+#define CHECKPOINT_VERSION 1
+
+// the particle-data starts at a fixed 4 KiB behind the header, so it can be
+// mapped and handed to glBufferSubData() or the CPU-backend as is, that's a
+// page-boundary only for 4 KiB pages, but keeps files portable between hosts,
+// release() rounds to the actual page-size itself
+#define CHECKPOINT_DATA_OFFSET 4096
+
+// everything needed to continue a run besides the particles themselves, all
+// values are stored in the host's native byte-order
+struct CheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t layout;            // ParticleLayout of the particle-data
+    uint64_t numParticles;
+    uint32_t bytesPerParticle;
+    uint32_t stepCount;
+    float timeStep;
+    float blackHoleMass;
+    float blackHolePosition[3]; // unrotated, in simulation-units
+    float angles[3];
+};
+
+// A checkpoint-file memory-mapped for either writing or reading. The GL-side
+// transfers go through it in chunks, each one is dropped from the mapping once
+// done, so even multi-GB states never need a second full copy in host-memory.
+class Checkpoint
+{
+    public:
+        Checkpoint ();
+        ~Checkpoint ();
+
+        // creates (or truncates) the file and sizes it for the particles
+        bool create (const char* filename, const CheckpointHeader& header);
+
+        // maps an existing file read-only, fails on a bad header or size
+        bool open (const char* filename);
+
+        // unmaps and for created files makes sure all data hit the disk
+        bool close ();
+
+        const CheckpointHeader& header () const;
+        void* particles () const;
+        size_t particleBytes () const;
+
+        // copies buffer's content into a created file via glMapBufferRange()
+        bool download (GLuint buffer);
+
+        // copies an opened file's particles into buffer via glBufferSubData()
+        bool upload (GLuint buffer);
+
+    private:
+        void release (size_t offset, size_t size);
+
+        int _fd;
+        bool _writable;
+        unsigned char* _map;
+        size_t _mapSize;
+        CheckpointHeader _header;
+};
+
+#endif // _CHECKPOINT_H
@@ -0,0 +1,429 @@
+////////////////////////////////////////////////////////////////////////////////
+//3456789 123456789 123456789 123456789 123456789 123456789 123456789 123456789
+//
+// A test trying out OpenGL 3.x's transform-feedback feature with some SDL2.x
+// glue code to make it work on multiple platforms
+//
+// Copyright 2015-2016 Mirco Müller
+//
+// Author(s):
+//   Mirco "MacSlow" Müller <macslow@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#if (defined __x86_64__ || defined __i386__) && defined __GNUC__
+#define HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#include "cpu-simulation.h"
+
+#define FLOATS_PER_PARTICLE 7
+#define SIMD_ALIGNMENT 64
+#define SIMD_PADDING 16
+
+// don't bother threads with less than this many particles at a time
+#define MIN_CHUNK_SIZE 4096
+
+// enough chunks per thread for stealing to even out the load
+#define CHUNKS_PER_THREAD 16
+
+typedef void (*GravityKernel) (ParticleArrays& arrays,
+                               size_t begin,
+                               size_t end,
+                               const GravityParams& params);
+
+bool allocParticleArrays (ParticleArrays* arrays, size_t count)
+{
+    size_t padded = (count + SIMD_PADDING - 1) / SIMD_PADDING * SIMD_PADDING;
+    size_t bytes = FLOATS_PER_PARTICLE * padded * sizeof (float);
+
+    std::memset (arrays, 0, sizeof (ParticleArrays));
+    arrays->block = std::calloc (bytes + SIMD_ALIGNMENT, 1);
+    if (!arrays->block) {
+        return false;
+    }
+
+    uintptr_t address = (uintptr_t) arrays->block;
+    address = (address + SIMD_ALIGNMENT - 1) & ~(uintptr_t) (SIMD_ALIGNMENT - 1);
+    float* base = (float*) address;
+
+    arrays->count = count;
+    arrays->x = base;
+    arrays->y = base + padded;
+    arrays->z = base + 2 * padded;
+    arrays->vx = base + 3 * padded;
+    arrays->vy = base + 4 * padded;
+    arrays->vz = base + 5 * padded;
+    arrays->distance = base + 6 * padded;
+
+    return true;
+}
+
+void freeParticleArrays (ParticleArrays* arrays)
+{
+    std::free (arrays->block);
+    std::memset (arrays, 0, sizeof (ParticleArrays));
+}
+
+static size_t chunkSizeFor (ThreadPool& pool, size_t count)
+{
+    size_t chunkSize = count / (pool.size () * CHUNKS_PER_THREAD);
+    if (chunkSize < MIN_CHUNK_SIZE) {
+        chunkSize = MIN_CHUNK_SIZE;
+    }
+
+    // keep chunks on whole cache-lines of every array
+    return (chunkSize + SIMD_PADDING - 1) / SIMD_PADDING * SIMD_PADDING;
+}
+
+void toParticleArrays (ThreadPool& pool,
+                       const float* data,
+                       ParticleArrays* arrays)
+{
+    pool.parallelFor (arrays->count,
+                      chunkSizeFor (pool, arrays->count),
+                      [&] (size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            const float* particle = data + i * FLOATS_PER_PARTICLE;
+            arrays->x[i] = particle[0];
+            arrays->y[i] = particle[1];
+            arrays->z[i] = particle[2];
+            arrays->vx[i] = particle[3];
+            arrays->vy[i] = particle[4];
+            arrays->vz[i] = particle[5];
+            arrays->distance[i] = particle[6];
+        }
+    });
+}
+
+void fromParticleArrays (ThreadPool& pool,
+                         const ParticleArrays& arrays,
+                         float* data)
+{
+    pool.parallelFor (arrays.count,
+                      chunkSizeFor (pool, arrays.count),
+                      [&] (size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            float* particle = data + i * FLOATS_PER_PARTICLE;
+            particle[0] = arrays.x[i];
+            particle[1] = arrays.y[i];
+            particle[2] = arrays.z[i];
+            particle[3] = arrays.vx[i];
+            particle[4] = arrays.vy[i];
+            particle[5] = arrays.vz[i];
+            particle[6] = arrays.distance[i];
+        }
+    });
+}
+
+// "lowbias32" integer-hash by Chris Wellons, a counter-based RNG needs no
+// state, so every chunk can start anywhere in the sequence
+static inline uint32_t hash (uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+void seedParticleArrays (ThreadPool& pool,
+                         ParticleArrays* arrays,
+                         uint32_t seed,
+                         float limit)
+{
+    uint32_t key = hash (seed);
+    pool.parallelFor (arrays->count,
+                      chunkSizeFor (pool, arrays->count),
+                      [&] (size_t begin, size_t end) {
+        float* position[3] = {arrays->x, arrays->y, arrays->z};
+        for (size_t i = begin; i < end; ++i) {
+            uint32_t counter = 3u * (uint32_t) i;
+            for (int c = 0; c < 3; ++c) {
+                float r = (float) (hash ((counter + c) ^ key) >> 8) /
+                          16777216.0f;
+                position[c][i] = (2.0f * r - 1.0f) * limit;
+            }
+            arrays->vx[i] = 0.0f;
+            arrays->vy[i] = 0.0f;
+            arrays->vz[i] = 0.0f;
+            arrays->distance[i] = 0.0f;
+        }
+    });
+}
+
+// all kernels do the same operations in the same order (no FMA), so they can
+// be checked against each other and the GPU-results
+static void stepGravityScalar (ParticleArrays& arrays,
+                               size_t begin,
+                               size_t end,
+                               const GravityParams& params)
+{
+    const float k = GRAVITY_G * PARTICLE_MASS * params.blackHoleMass;
+    const float* bh = params.blackHolePosition;
+    const float* limits = params.limits;
+    float* pos[3] = {arrays.x, arrays.y, arrays.z};
+    float* vel[3] = {arrays.vx, arrays.vy, arrays.vz};
+
+    for (size_t i = begin; i < end; ++i) {
+        float p[3] = {bh[0] - pos[0][i], bh[1] - pos[1][i], bh[2] - pos[2][i]};
+        float dist = std::sqrt (p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+        float d = dist * dist;
+
+        // f = k * normalize (v) / d, a = particleMass * f
+        float scale = PARTICLE_MASS * k / (dist * d);
+
+        bool outside = false;
+        float tmp[3];
+        for (int c = 0; c < 3; ++c) {
+            float newVelocity = scale * p[c] + vel[c][i];
+            tmp[c] = .475f * (vel[c][i] + newVelocity);
+            float newPosition = pos[c][i] + tmp[c] * params.timeStep;
+            if (newPosition <= -limits[c]) {
+                newPosition = limits[c];
+                outside = true;
+            } else if (newPosition >= limits[c]) {
+                newPosition = -limits[c];
+                outside = true;
+            }
+            pos[c][i] = newPosition;
+        }
+
+        float damping = outside ? 0.1f : 1.0f;
+        for (int c = 0; c < 3; ++c) {
+            vel[c][i] = damping * tmp[c];
+        }
+        arrays.distance[i] = dist;
+    }
+}
+
+#if defined HAVE_X86_SIMD
+
+// the wrap-around is done with compare-masks and blends instead of branches
+__attribute__ ((target ("avx2")))
+static void stepGravityAVX2 (ParticleArrays& arrays,
+                             size_t begin,
+                             size_t end,
+                             const GravityParams& params)
+{
+    const float k = GRAVITY_G * PARTICLE_MASS * params.blackHoleMass;
+    const __m256 massK = _mm256_set1_ps (PARTICLE_MASS * k);
+    const __m256 half = _mm256_set1_ps (.475f);
+    const __m256 dt = _mm256_set1_ps (params.timeStep);
+    const __m256 damping = _mm256_set1_ps (0.1f);
+    const __m256 one = _mm256_set1_ps (1.0f);
+    float* pos[3] = {arrays.x, arrays.y, arrays.z};
+    float* vel[3] = {arrays.vx, arrays.vy, arrays.vz};
+    __m256 bh[3];
+    __m256 limit[3];
+    __m256 negLimit[3];
+    for (int c = 0; c < 3; ++c) {
+        bh[c] = _mm256_set1_ps (params.blackHolePosition[c]);
+        limit[c] = _mm256_set1_ps (params.limits[c]);
+        negLimit[c] = _mm256_set1_ps (-params.limits[c]);
+    }
+
+    size_t i = begin;
+    for (; i + 8 <= end; i += 8) {
+        __m256 p[3];
+        __m256 v[3];
+        for (int c = 0; c < 3; ++c) {
+            p[c] = _mm256_sub_ps (bh[c], _mm256_load_ps (pos[c] + i));
+            v[c] = _mm256_load_ps (vel[c] + i);
+        }
+        __m256 sum = _mm256_add_ps (_mm256_add_ps (_mm256_mul_ps (p[0], p[0]),
+                                                   _mm256_mul_ps (p[1], p[1])),
+                                    _mm256_mul_ps (p[2], p[2]));
+        __m256 dist = _mm256_sqrt_ps (sum);
+        __m256 d = _mm256_mul_ps (dist, dist);
+        __m256 scale = _mm256_div_ps (massK, _mm256_mul_ps (dist, d));
+
+        __m256 outside = _mm256_setzero_ps ();
+        __m256 tmp[3];
+        for (int c = 0; c < 3; ++c) {
+            __m256 newVelocity = _mm256_add_ps (_mm256_mul_ps (scale, p[c]),
+                                                v[c]);
+            tmp[c] = _mm256_mul_ps (half, _mm256_add_ps (v[c], newVelocity));
+            __m256 newPosition = _mm256_add_ps (_mm256_load_ps (pos[c] + i),
+                                                _mm256_mul_ps (tmp[c], dt));
+            __m256 below = _mm256_cmp_ps (newPosition, negLimit[c], _CMP_LE_OQ);
+            __m256 above = _mm256_cmp_ps (newPosition, limit[c], _CMP_GE_OQ);
+            newPosition = _mm256_blendv_ps (newPosition, negLimit[c], above);
+            newPosition = _mm256_blendv_ps (newPosition, limit[c], below);
+            outside = _mm256_or_ps (outside, _mm256_or_ps (below, above));
+            _mm256_store_ps (pos[c] + i, newPosition);
+        }
+
+        __m256 factor = _mm256_blendv_ps (one, damping, outside);
+        for (int c = 0; c < 3; ++c) {
+            _mm256_store_ps (vel[c] + i, _mm256_mul_ps (factor, tmp[c]));
+        }
+        _mm256_store_ps (arrays.distance + i, dist);
+    }
+
+    stepGravityScalar (arrays, i, end, params);
+}
+
+__attribute__ ((target ("avx512f")))
+static void stepGravityAVX512 (ParticleArrays& arrays,
+                               size_t begin,
+                               size_t end,
+                               const GravityParams& params)
+{
+    const float k = GRAVITY_G * PARTICLE_MASS * params.blackHoleMass;
+    const __m512 massK = _mm512_set1_ps (PARTICLE_MASS * k);
+    const __m512 half = _mm512_set1_ps (.475f);
+    const __m512 dt = _mm512_set1_ps (params.timeStep);
+    const __m512 damping = _mm512_set1_ps (0.1f);
+    const __m512 one = _mm512_set1_ps (1.0f);
+    float* pos[3] = {arrays.x, arrays.y, arrays.z};
+    float* vel[3] = {arrays.vx, arrays.vy, arrays.vz};
+    __m512 bh[3];
+    __m512 limit[3];
+    __m512 negLimit[3];
+    for (int c = 0; c < 3; ++c) {
+        bh[c] = _mm512_set1_ps (params.blackHolePosition[c]);
+        limit[c] = _mm512_set1_ps (params.limits[c]);
+        negLimit[c] = _mm512_set1_ps (-params.limits[c]);
+    }
+
+    size_t i = begin;
+    for (; i + 16 <= end; i += 16) {
+        __m512 p[3];
+        __m512 v[3];
+        for (int c = 0; c < 3; ++c) {
+            p[c] = _mm512_sub_ps (bh[c], _mm512_load_ps (pos[c] + i));
+            v[c] = _mm512_load_ps (vel[c] + i);
+        }
+        __m512 sum = _mm512_add_ps (_mm512_add_ps (_mm512_mul_ps (p[0], p[0]),
+                                                   _mm512_mul_ps (p[1], p[1])),
+                                    _mm512_mul_ps (p[2], p[2]));
+        // same as _mm512_sqrt_ps(), which trips gcc's -Wmaybe-uninitialized
+        __m512 dist = _mm512_maskz_sqrt_ps ((__mmask16) 0xffff, sum);
+        __m512 d = _mm512_mul_ps (dist, dist);
+        __m512 scale = _mm512_div_ps (massK, _mm512_mul_ps (dist, d));
+
+        __mmask16 outside = 0;
+        __m512 tmp[3];
+        for (int c = 0; c < 3; ++c) {
+            __m512 newVelocity = _mm512_add_ps (_mm512_mul_ps (scale, p[c]),
+                                                v[c]);
+            tmp[c] = _mm512_mul_ps (half, _mm512_add_ps (v[c], newVelocity));
+            __m512 newPosition = _mm512_add_ps (_mm512_load_ps (pos[c] + i),
+                                                _mm512_mul_ps (tmp[c], dt));
+            __mmask16 below = _mm512_cmp_ps_mask (newPosition,
+                                                  negLimit[c],
+                                                  _CMP_LE_OQ);
+            __mmask16 above = _mm512_cmp_ps_mask (newPosition,
+                                                  limit[c],
+                                                  _CMP_GE_OQ);
+            newPosition = _mm512_mask_blend_ps (above, newPosition, negLimit[c]);
+            newPosition = _mm512_mask_blend_ps (below, newPosition, limit[c]);
+            outside = outside | below | above;
+            _mm512_store_ps (pos[c] + i, newPosition);
+        }
+
+        __m512 factor = _mm512_mask_blend_ps (outside, one, damping);
+        for (int c = 0; c < 3; ++c) {
+            _mm512_store_ps (vel[c] + i, _mm512_mul_ps (factor, tmp[c]));
+        }
+        _mm512_store_ps (arrays.distance + i, dist);
+    }
+
+    stepGravityScalar (arrays, i, end, params);
+}
+
+#endif // HAVE_X86_SIMD
+
+static GravityKernel kernel = nullptr;
+static const char* kernelName = nullptr;
+
+static void selectDefaultKernel ()
+{
+    kernel = stepGravityScalar;
+    kernelName = "scalar";
+
+#if defined HAVE_X86_SIMD
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx512f")) {
+        kernel = stepGravityAVX512;
+        kernelName = "avx512";
+    } else if (__builtin_cpu_supports ("avx2")) {
+        kernel = stepGravityAVX2;
+        kernelName = "avx2";
+    }
+#endif
+}
+
+bool setGravityKernel (const char* name)
+{
+    std::string wanted (name ? name : "");
+
+    if (wanted == "scalar") {
+        kernel = stepGravityScalar;
+        kernelName = "scalar";
+        return true;
+    }
+
+#if defined HAVE_X86_SIMD
+    __builtin_cpu_init ();
+    if (wanted == "avx2" && __builtin_cpu_supports ("avx2")) {
+        kernel = stepGravityAVX2;
+        kernelName = "avx2";
+        return true;
+    }
+
+    if (wanted == "avx512" && __builtin_cpu_supports ("avx512f")) {
+        kernel = stepGravityAVX512;
+        kernelName = "avx512";
+        return true;
+    }
+#endif
+
+    return false;
+}
+
+const char* gravityKernelName ()
+{
+    if (!kernel) {
+        selectDefaultKernel ();
+    }
+
+    return kernelName;
+}
+
+void stepGravity (ThreadPool& pool,
+                  ParticleArrays& arrays,
+                  const GravityParams& params)
+{
+    if (!kernel) {
+        selectDefaultKernel ();
+    }
+
+    GravityKernel func = kernel;
+    pool.parallelFor (arrays.count,
+                      chunkSizeFor (pool, arrays.count),
+                      [&] (size_t begin, size_t end) {
+                          func (arrays, begin, end, params);
+                      });
+}
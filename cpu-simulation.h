@@ -0,0 +1,91 @@
+////////////////////////////////////////////////////////////////////////////////
+//3456789 123456789 123456789 123456789 123456789 123456789 123456789 123456789
+//
+// A test trying out OpenGL 3.x's transform-feedback feature with some SDL2.x
+// glue code to make it work on multiple platforms
+//
+// Copyright 2015-2016 Mirco Müller
+//
+// Author(s):
+//   Mirco "MacSlow" Müller <macslow@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _CPU_SIMULATION_H
+#define _CPU_SIMULATION_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "thread-pool.h"
+
+// same constants as in particleGravitySrc
+#define GRAVITY_G 0.0000000000667384f
+#define PARTICLE_MASS 1000.0f
+
+// everything particleGravitySrc gets as uniforms, but with the black-hole
+// position already rotated into particle-space
+struct GravityParams {
+    float blackHolePosition[3];
+    float blackHoleMass;
+    float limits[3];
+    float timeStep;
+};
+
+// structure-of-arrays copy of the particles for the CPU-backend, every array
+// is 64-byte aligned and padded to a multiple of 16 floats for SIMD
+struct ParticleArrays {
+    size_t count;
+    float* x;
+    float* y;
+    float* z;
+    float* vx;
+    float* vy;
+    float* vz;
+    float* distance;
+    void* block;
+};
+
+bool allocParticleArrays (ParticleArrays* arrays, size_t count);
+void freeParticleArrays (ParticleArrays* arrays);
+
+// convert from/to the 7-floats-per-particle (position, velocity, distance)
+// interleaved layout the GL-side uses
+void toParticleArrays (ThreadPool& pool,
+                       const float* data,
+                       ParticleArrays* arrays);
+void fromParticleArrays (ThreadPool& pool,
+                         const ParticleArrays& arrays,
+                         float* data);
+
+// places particle i at a position in [-limit, limit)^3 that only depends on
+// i and seed (same hash as seedSrc), at rest, so the result is the same for
+// any number of threads and matches the GPU-backend's seeding
+void seedParticleArrays (ThreadPool& pool,
+                         ParticleArrays* arrays,
+                         uint32_t seed,
+                         float limit);
+
+// picks a kernel ("scalar", "avx2" or "avx512"), by default the widest one
+// the CPU supports is used, returns false if it's unknown or unsupported
+bool setGravityKernel (const char* name);
+const char* gravityKernelName ();
+
+// advances all particles by one step exactly like particleGravitySrc does
+void stepGravity (ThreadPool& pool,
+                  ParticleArrays& arrays,
+                  const GravityParams& params);
+
+#endif // _CPU_SIMULATION_H
@@ -0,0 +1,128 @@
+////////////////////////////////////////////////////////////////////////////////
+//3456789 123456789 123456789 123456789 123456789 123456789 123456789 123456789
+//
+// A test trying out OpenGL 3.x's transform-feedback feature with some SDL2.x
+// glue code to make it work on multiple platforms
+//
+// Copyright 2015-2016 Mirco Müller
+//
+// Author(s):
+//   Mirco "MacSlow" Müller <macslow@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+
+#include "gravity-sources.h"
+
+bool loadGravitySources (const char* filename,
+                         std::vector<GravitySource>& sources)
+{
+    std::ifstream file (filename);
+    if (!file) {
+        std::cout << "Failed to open gravity-sources " << filename
+                  << std::endl;
+        return false;
+    }
+
+    std::string line;
+    unsigned int lineNumber = 0;
+    while (std::getline (file, line)) {
+        ++lineNumber;
+        std::istringstream stream (line);
+        GravitySource source = {{0.0f, 0.0f, 0.0f}, 0.0f, {0.0f, 0.0f, 0.0f}};
+        std::string first;
+        if (!(stream >> first) || first[0] == '#') {
+            continue;
+        }
+
+        stream.clear ();
+        stream.str (line);
+        if (!(stream >> source.position[0]
+                     >> source.position[1]
+                     >> source.position[2]
+                     >> source.mass)) {
+            std::cout << filename << ":" << lineNumber
+                      << ": expected x y z mass [vx vy vz]" << std::endl;
+            return false;
+        }
+
+        // the velocity is optional, but if it's there it has to be complete
+        if (stream >> source.velocity[0] &&
+            !(stream >> source.velocity[1] >> source.velocity[2])) {
+            std::cout << filename << ":" << lineNumber
+                      << ": incomplete velocity" << std::endl;
+            return false;
+        }
+
+        sources.push_back (source);
+    }
+
+    return true;
+}
+
+void randomGravitySources (size_t count,
+                           float limit,
+                           float totalMass,
+                           std::vector<GravitySource>& sources)
+{
+    std::mt19937 generator (count);
+    std::uniform_real_distribution<float> distributed (-limit, limit);
+
+    for (size_t i = 0; i < count; ++i) {
+        GravitySource source = {{0.0f, 0.0f, 0.0f},
+                                totalMass / count,
+                                {0.0f, 0.0f, 0.0f}};
+        for (int c = 0; c < 3; ++c) {
+            source.position[c] = distributed (generator);
+        }
+        sources.push_back (source);
+    }
+}
+
+bool hasMovingGravitySources (const std::vector<GravitySource>& sources)
+{
+    for (const GravitySource& source : sources) {
+        if (source.velocity[0] != 0.0f ||
+            source.velocity[1] != 0.0f ||
+            source.velocity[2] != 0.0f) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void moveGravitySources (std::vector<GravitySource>& sources,
+                         float timeStep,
+                         const float* limits)
+{
+    for (GravitySource& source : sources) {
+        for (int c = 0; c < 3; ++c) {
+            float position = source.position[c] +
+                             source.velocity[c] * timeStep;
+            if (position <= -limits[c]) {
+                position += 2.0f * limits[c];
+            } else if (position >= limits[c]) {
+                position -= 2.0f * limits[c];
+            }
+            source.position[c] = position;
+        }
+    }
+}
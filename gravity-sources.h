@@ -0,0 +1,58 @@
+////////////////////////////////////////////////////////////////////////////////
+//3456789 123456789 123456789 123456789 123456789 123456789 123456789 123456789
+//
+// A test trying out OpenGL 3.x's transform-feedback feature with some SDL2.x
+// glue code to make it work on multiple platforms
+//
+// Copyright 2015-2016 Mirco Müller
+//
+// Author(s):
+//   Mirco "MacSlow" Müller <macslow@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _GRAVITY_SOURCES_H
+#define _GRAVITY_SOURCES_H
+
+#include <cstddef>
+#include <vector>
+
+// an additional attractor (or repeller with a negative mass), sources with a
+// velocity move through the simulation-volume and wrap around at its limits
+struct GravitySource {
+    float position[3];
+    float mass;
+    float velocity[3];
+};
+
+// reads one source per line as "x y z mass [vx vy vz]", empty lines and lines
+// starting with # are skipped
+bool loadGravitySources (const char* filename,
+                         std::vector<GravitySource>& sources);
+
+// count static sources at uniformly random positions in the box +/-limit,
+// seeded by count, so they're always the same ones and benchmark-runs stay
+// comparable, their masses add up to totalMass
+void randomGravitySources (size_t count,
+                           float limit,
+                           float totalMass,
+                           std::vector<GravitySource>& sources);
+
+bool hasMovingGravitySources (const std::vector<GravitySource>& sources);
+void moveGravitySources (std::vector<GravitySource>& sources,
+                         float timeStep,
+                         const float* limits);
+
+#endif // _GRAVITY_SOURCES_H
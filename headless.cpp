@@ -0,0 +1,110 @@
+////////////////////////////////////////////////////////////////////////////////
+//3456789 123456789 123456789 123456789 123456789 123456789 123456789 123456789
+//
+// A test trying out OpenGL 3.x's transform-feedback feature with some SDL2.x
+// glue code to make it work on multiple platforms
+//
+// Copyright 2015-2016 Mirco Müller
+//
+// Author(s):
+//   Mirco "MacSlow" Müller <macslow@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <iostream>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "headless.h"
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+static EGLDisplay display = EGL_NO_DISPLAY;
+static EGLContext context = EGL_NO_CONTEXT;
+
+bool createHeadlessContext ()
+{
+    // prefer mesa's surfaceless platform, it needs neither X11 nor a GPU
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = nullptr;
+    getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+                         eglGetProcAddress ("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay) {
+        display = getPlatformDisplay (EGL_PLATFORM_SURFACELESS_MESA,
+                                      EGL_DEFAULT_DISPLAY,
+                                      NULL);
+    }
+
+    if (display == EGL_NO_DISPLAY) {
+        display = eglGetDisplay (EGL_DEFAULT_DISPLAY);
+    }
+
+    EGLint major = 0;
+    EGLint minor = 0;
+    if (display == EGL_NO_DISPLAY || !eglInitialize (display, &major, &minor)) {
+        std::cout << "eglInitialize() failed: 0x" << std::hex << eglGetError ()
+                  << std::dec << std::endl;
+        display = EGL_NO_DISPLAY;
+        return false;
+    }
+
+    if (!eglBindAPI (EGL_OPENGL_API)) {
+        std::cout << "eglBindAPI() failed: 0x" << std::hex << eglGetError ()
+                  << std::dec << std::endl;
+        destroyHeadlessContext ();
+        return false;
+    }
+
+    // no config and no surface, all rendering goes into buffer-objects
+    context = eglCreateContext (display,
+                                (EGLConfig) 0,
+                                EGL_NO_CONTEXT,
+                                NULL);
+    if (context == EGL_NO_CONTEXT) {
+        std::cout << "eglCreateContext() failed: 0x" << std::hex
+                  << eglGetError () << std::dec << std::endl;
+        destroyHeadlessContext ();
+        return false;
+    }
+
+    if (!eglMakeCurrent (display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+        std::cout << "eglMakeCurrent() failed: 0x" << std::hex << eglGetError ()
+                  << std::dec << std::endl;
+        destroyHeadlessContext ();
+        return false;
+    }
+
+    std::cout << "created headless EGL " << major << "." << minor
+              << " context" << std::endl;
+
+    return true;
+}
+
+void destroyHeadlessContext ()
+{
+    if (display == EGL_NO_DISPLAY) {
+        return;
+    }
+
+    eglMakeCurrent (display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (context != EGL_NO_CONTEXT) {
+        eglDestroyContext (display, context);
+        context = EGL_NO_CONTEXT;
+    }
+    eglTerminate (display);
+    display = EGL_NO_DISPLAY;
+}
@@ -0,0 +1,181 @@
+////////////////////////////////////////////////////////////////////////////////
+//3456789 123456789 123456789 123456789 123456789 123456789 123456789 123456789
+//
+// A test trying out OpenGL 3.x's transform-feedback feature with some SDL2.x
+// glue code to make it work on multiple platforms
+//
+// Copyright 2015-2016 Mirco Müller
+//
+// Author(s):
+//   Mirco "MacSlow" Müller <macslow@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include "morton-order.h"
+#include "radix-sort.h"
+
+#define MORTON_BITS 10
+
+// don't bother threads with less than this many particles at a time
+#define MIN_CHUNK_SIZE 16384
+
+// spreads the lower 10 bits of v out to every third bit
+static uint32_t spreadBits (uint32_t v)
+{
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8)) & 0x0300f00f;
+    v = (v | (v << 4)) & 0x030c30c3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+// cells are numbered from 0 at -limit to 1023 at limit, x is the most
+// significant axis like in BarnesHut
+static uint32_t mortonCode (const float* position, float limit)
+{
+    float scale = (float) (1 << MORTON_BITS) / (2.0f * limit);
+    uint32_t code = 0;
+    for (int c = 0; c < 3; ++c) {
+        float cell = (position[c] + limit) * scale;
+        cell = std::min (std::max (cell, 0.0f), 1023.0f);
+        code |= spreadBits ((uint32_t) cell) << (2 - c);
+    }
+
+    return code;
+}
+
+static size_t chunkSizeFor (ThreadPool& pool, size_t count)
+{
+    size_t chunkSize = count / (pool.size () * 4) + 1;
+    return chunkSize < MIN_CHUNK_SIZE ? MIN_CHUNK_SIZE : chunkSize;
+}
+
+MortonOrder::MortonOrder ()
+{
+    std::memset (&_scratch, 0, sizeof (_scratch));
+}
+
+MortonOrder::~MortonOrder ()
+{
+    freeParticleArrays (&_scratch);
+}
+
+void MortonOrder::sortFloats (ThreadPool& pool,
+                              const float* data,
+                              size_t count,
+                              float limit)
+{
+    _codes.resize (count);
+    pool.parallelFor (count,
+                      chunkSizeFor (pool, count),
+                      [&] (size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            _codes[i] = mortonCode (&data[7 * i], limit);
+        }
+    });
+
+    sort (pool);
+}
+
+void MortonOrder::sortPacked (ThreadPool& pool,
+                              const uint16_t* data,
+                              size_t count)
+{
+    _codes.resize (count);
+    pool.parallelFor (count,
+                      chunkSizeFor (pool, count),
+                      [&] (size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            const uint16_t* position = &data[6 * i];
+            uint32_t code = 0;
+            for (int c = 0; c < 3; ++c) {
+                code |= spreadBits (position[c] >> (16 - MORTON_BITS)) <<
+                        (2 - c);
+            }
+            _codes[i] = code;
+        }
+    });
+
+    sort (pool);
+}
+
+void MortonOrder::apply (ThreadPool& pool, ParticleArrays* arrays, float limit)
+{
+    size_t count = arrays->count;
+    size_t chunkSize = chunkSizeFor (pool, count);
+    _codes.resize (count);
+    pool.parallelFor (count, chunkSize, [&] (size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            float position[3] = {arrays->x[i], arrays->y[i], arrays->z[i]};
+            _codes[i] = mortonCode (position, limit);
+        }
+    });
+
+    sort (pool);
+
+    if (_scratch.count != count) {
+        freeParticleArrays (&_scratch);
+        if (!allocParticleArrays (&_scratch, count)) {
+            return;
+        }
+    }
+
+    // gather into the scratch-arrays and swap them in, the old ones are
+    // the scratch-space next time
+    float* from[7] = {arrays->x, arrays->y, arrays->z,
+                      arrays->vx, arrays->vy, arrays->vz,
+                      arrays->distance};
+    float* to[7] = {_scratch.x, _scratch.y, _scratch.z,
+                    _scratch.vx, _scratch.vy, _scratch.vz,
+                    _scratch.distance};
+    pool.parallelFor (count, chunkSize, [&] (size_t begin, size_t end) {
+        for (int a = 0; a < 7; ++a) {
+            for (size_t k = begin; k < end; ++k) {
+                to[a][k] = from[a][_order[k]];
+            }
+        }
+    });
+    std::swap (*arrays, _scratch);
+}
+
+const std::vector<uint32_t>& MortonOrder::order () const
+{
+    return _order;
+}
+
+void MortonOrder::sort (ThreadPool& pool)
+{
+    size_t count = _codes.size ();
+    _codesTmp.resize (count);
+    _order.resize (count);
+    _orderTmp.resize (count);
+    for (size_t i = 0; i < count; ++i) {
+        _order[i] = (uint32_t) i;
+    }
+
+    radixSort (pool,
+               chunkSizeFor (pool, count),
+               3 * MORTON_BITS,
+               _codes,
+               _codesTmp,
+               _order,
+               _orderTmp,
+               _histograms);
+}
@@ -0,0 +1,72 @@
+////////////////////////////////////////////////////////////////////////////////
+//3456789 123456789 123456789 123456789 123456789 123456789 123456789 123456789
+//
+// A test trying out OpenGL 3.x's transform-feedback feature with some SDL2.x
+// glue code to make it work on multiple platforms
+//
+// Copyright 2015-2016 Mirco Müller
+//
+// Author(s):
+//   Mirco "MacSlow" Müller <macslow@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _MORTON_ORDER_H
+#define _MORTON_ORDER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "cpu-simulation.h"
+#include "thread-pool.h"
+
+// Puts particles in the order of a Morton-curve (Z-order) through the
+// simulation-volume [-limit, limit]^3, so ones close in space end up close in
+// memory as well. The codes have 10 bits per axis, cells of 1/1024 of the
+// volume are already far smaller than what any cache could tell apart.
+class MortonOrder
+{
+    public:
+        MortonOrder ();
+        ~MortonOrder ();
+
+        // sort by the positions of count interleaved particles, either in
+        // the float-layout (7 floats each) or the packed one (6 unsigned
+        // shorts each, the first three being the normalized position)
+        void sortFloats (ThreadPool& pool,
+                         const float* data,
+                         size_t count,
+                         float limit);
+        void sortPacked (ThreadPool& pool, const uint16_t* data, size_t count);
+
+        // sorts the CPU-backend's arrays and puts them in that order
+        void apply (ThreadPool& pool, ParticleArrays* arrays, float limit);
+
+        // order ()[k] is the particle that belongs to index k
+        const std::vector<uint32_t>& order () const;
+
+    private:
+        void sort (ThreadPool& pool);
+
+        std::vector<uint32_t> _codes;
+        std::vector<uint32_t> _codesTmp;
+        std::vector<uint32_t> _order;
+        std::vector<uint32_t> _orderTmp;
+        std::vector<uint32_t> _histograms;
+        ParticleArrays _scratch;
+};
+
+#endif // _MORTON_ORDER_H
@@ -0,0 +1,212 @@
+////////////////////////////////////////////////////////////////////////////////
+//3456789 123456789 123456789 123456789 123456789 123456789 123456789 123456789
+//
+// A test trying out OpenGL 3.x's transform-feedback feature with some SDL2.x
+// glue code to make it work on multiple platforms
+//
+// Copyright 2015-2016 Mirco Müller
+//
+// Author(s):
+//   Mirco "MacSlow" Müller <macslow@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "program-cache.h"
+
+static std::string glString (GLenum name)
+{
+    const GLubyte* value = glGetString (name);
+    return value ? std::string ((const char*) value) : std::string ();
+}
+
+static uint64_t fnv1a (uint64_t hash, const std::string& data)
+{
+    for (unsigned char c : data) {
+        hash = (hash ^ c) * 1099511628211ull;
+    }
+
+    return hash;
+}
+
+ProgramCache::ProgramCache (const char* directory)
+    : _directory (directory)
+    , _usable (false)
+{
+    GLint formats = 0;
+    if (GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary) {
+        glGetIntegerv (GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    }
+    if (formats <= 0) {
+        return;
+    }
+    _formats.resize ((size_t) formats);
+    glGetIntegerv (GL_PROGRAM_BINARY_FORMATS, _formats.data ());
+
+    if (mkdir (directory, 0755) != 0 && errno != EEXIST) {
+        std::cout << "Failed to create shader-cache " << directory << ": "
+                  << std::strerror (errno) << std::endl;
+        return;
+    }
+
+    // binaries are only valid for the exact same driver
+    _driver = glString (GL_VENDOR) + "\n" +
+              glString (GL_RENDERER) + "\n" +
+              glString (GL_VERSION) + "\n" +
+              glString (GL_SHADING_LANGUAGE_VERSION) + "\n";
+    _usable = true;
+}
+
+bool ProgramCache::usable () const
+{
+    return _usable;
+}
+
+GLuint ProgramCache::load (const std::string& source)
+{
+    if (!_usable) {
+        return 0;
+    }
+
+    uint32_t keyLength = 0;
+    uint64_t hash = key (source, &keyLength);
+    std::ifstream file (path (hash), std::ios::binary);
+    if (!file) {
+        return 0;
+    }
+
+    ProgramCacheHeader header;
+    if (!file.read ((char*) &header, sizeof (header)) ||
+        std::memcmp (header.magic,
+                     PROGRAM_CACHE_MAGIC,
+                     sizeof (header.magic)) ||
+        header.version != PROGRAM_CACHE_VERSION ||
+        header.key != hash ||
+        header.keyLength != keyLength ||
+        header.length == 0) {
+        return 0;
+    }
+
+    // an unknown format would raise GL_INVALID_ENUM, which a later
+    // glGetError() elsewhere would then blame on something else
+    if (std::find (_formats.begin (),
+                   _formats.end (),
+                   (GLint) header.format) == _formats.end ()) {
+        return 0;
+    }
+
+    std::vector<char> binary (header.length);
+    if (!file.read (binary.data (), header.length)) {
+        return 0;
+    }
+
+    GLuint program = glCreateProgram ();
+    glProgramBinary (program,
+                     (GLenum) header.format,
+                     binary.data (),
+                     (GLsizei) header.length);
+
+    // a rejected binary only fails the link-status, that just means linking
+    // from source again
+    GLint linked = 0;
+    glGetProgramiv (program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        glDeleteProgram (program);
+        return 0;
+    }
+
+    return program;
+}
+
+void ProgramCache::prepare (GLuint program)
+{
+    if (_usable) {
+        glProgramParameteri (program,
+                             GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                             GL_TRUE);
+    }
+}
+
+void ProgramCache::store (const std::string& source, GLuint program)
+{
+    if (!_usable || !glIsProgram (program)) {
+        return;
+    }
+
+    GLint linked = 0;
+    GLint length = 0;
+    glGetProgramiv (program, GL_LINK_STATUS, &linked);
+    glGetProgramiv (program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (!linked || length <= 0) {
+        return;
+    }
+
+    std::vector<char> binary ((size_t) length);
+    GLsizei written = 0;
+    GLenum format = 0;
+    glGetProgramBinary (program, length, &written, &format, binary.data ());
+    if (written <= 0) {
+        return;
+    }
+
+    ProgramCacheHeader header;
+    std::memset (&header, 0, sizeof (header));
+    std::memcpy (header.magic, PROGRAM_CACHE_MAGIC, sizeof (header.magic));
+    header.version = PROGRAM_CACHE_VERSION;
+    header.format = (uint32_t) format;
+    header.key = key (source, &header.keyLength);
+    header.length = (uint32_t) written;
+
+    // readers only ever see complete files, the last writer wins
+    std::string target = path (header.key);
+    std::string temporary = target + "." + std::to_string (getpid ()) + ".tmp";
+    std::ofstream file (temporary, std::ios::binary | std::ios::trunc);
+    file.write ((const char*) &header, sizeof (header));
+    file.write (binary.data (), written);
+    file.close ();
+    if (!file || std::rename (temporary.c_str (), target.c_str ()) != 0) {
+        std::cout << "Failed to write shader-cache " << target << std::endl;
+        std::remove (temporary.c_str ());
+    }
+}
+
+uint64_t ProgramCache::key (const std::string& source, uint32_t* length) const
+{
+    uint64_t hash = fnv1a (fnv1a (14695981039346656037ull, _driver), source);
+    *length = (uint32_t) (_driver.size () + source.size ());
+
+    return hash;
+}
+
+std::string ProgramCache::path (uint64_t key) const
+{
+    std::stringstream name;
+    name << _directory << "/" << std::hex << std::setw (16)
+         << std::setfill ('0') << key << ".bin";
+
+    return name.str ();
+}
@@ -0,0 +1,84 @@
+////////////////////////////////////////////////////////////////////////////////
+//3456789 123456789 123456789 123456789 123456789 123456789 123456789 123456789
+//
+// A test trying out OpenGL 3.x's transform-feedback feature with some SDL2.x
+// glue code to make it work on multiple platforms
+//
+// Copyright 2015-2016 Mirco Müller
+//
+// Author(s):
+//   Mirco "MacSlow" Müller <macslow@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _PROGRAM_CACHE_H
+#define _PROGRAM_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+
+#define PROGRAM_CACHE_MAGIC   "TFPROG1"
+#define PROGRAM_CACHE_VERSION 1
+
+// A cache-file is a ProgramCacheHeader followed by length bytes of what
+// glGetProgramBinary() returned. Its name is the hex-string of key, the
+// 64-bit FNV-1a hash of the driver-strings and the program's sources.
+struct ProgramCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t format;    // binaryFormat of glProgramBinary()
+    uint64_t key;
+    uint32_t keyLength; // bytes that went into key, guards against collisions
+    uint32_t length;
+};
+
+// Keeps linked programs on disk between runs via glGetProgramBinary() and
+// glProgramBinary() (OpenGL 4.1 or ARB_get_program_binary). A binary the
+// driver rejects, e.g. after an update it didn't change its strings for,
+// counts as a miss, the caller links from source and store() replaces it.
+// Files are written under a temporary name and renamed, so any number of
+// processes can share one directory.
+class ProgramCache
+{
+    public:
+        // needs a current context, creates directory if it doesn't exist
+        ProgramCache (const char* directory);
+
+        // false without driver-support or a usable directory
+        bool usable () const;
+
+        // a linked program for source or 0 if there's none (or not anymore)
+        GLuint load (const std::string& source);
+
+        // to be called before linking a program that is going to be stored
+        void prepare (GLuint program);
+
+        // saves program's binary, does nothing if it failed to link
+        void store (const std::string& source, GLuint program);
+
+    private:
+        uint64_t key (const std::string& source, uint32_t* length) const;
+        std::string path (uint64_t key) const;
+
+        std::string _directory;
+        std::string _driver;
+        std::vector<GLint> _formats;
+        bool _usable;
+};
+
+#endif // _PROGRAM_CACHE_H
@@ -0,0 +1,212 @@
+////////////////////////////////////////////////////////////////////////////////
+//3456789 123456789 123456789 123456789 123456789 123456789 123456789 123456789
+//
+// A test trying out OpenGL 3.x's transform-feedback feature with some SDL2.x
+// glue code to make it work on multiple platforms
+//
+// Copyright 2015-2016 Mirco Müller
+//
+// Author(s):
+//   Mirco "MacSlow" Müller <macslow@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <sstream>
+
+#include "quality-controller.h"
+
+// frames to average before deciding anything
+#define QUALITY_WINDOW 30
+
+// frames ignored after a change, timer-queries report a few frames late
+#define QUALITY_SETTLE_FRAMES 10
+
+// over budget means above 105%, under budget below 75%, the gap in between
+// keeps the controller from toggling a setting back and forth
+#define QUALITY_OVER 1.05
+#define QUALITY_UNDER 0.75
+
+// a setting is only restored if the frame is predicted to still fit in 90%
+#define QUALITY_HEADROOM 0.9
+
+QualityController::QualityController (double budget) :
+    _budget (budget)
+{
+    QualitySettings none = {1, 1, 1};
+    _most = none;
+    _least = none;
+    _settings = none;
+    restart ();
+}
+
+QualityController::~QualityController ()
+{
+}
+
+void QualityController::setLimits (const QualitySettings& most,
+                                   const QualitySettings& least)
+{
+    if (most.subSteps == _most.subSteps &&
+        most.particles == _most.particles &&
+        most.decimation == _most.decimation &&
+        least.subSteps == _least.subSteps &&
+        least.particles == _least.particles &&
+        least.decimation == _least.decimation) {
+        return;
+    }
+
+    _most = most;
+    _least = least;
+    _settings = most;
+    restart ();
+}
+
+void QualityController::addSteps (double milliseconds, unsigned int steps)
+{
+    if (_settling == 0) {
+        _stepMs += milliseconds;
+        _stepsTimed += steps;
+    }
+}
+
+void QualityController::addDraw (double milliseconds)
+{
+    if (_settling == 0) {
+        _drawMs += milliseconds;
+        ++_drawsTimed;
+    }
+}
+
+bool QualityController::endFrame (unsigned int steps)
+{
+    if (_settling > 0) {
+        --_settling;
+        return false;
+    }
+
+    _steps += steps;
+    if (++_frames < QUALITY_WINDOW) {
+        return false;
+    }
+
+    // frames without a step or a finished timer-query still count, so the
+    // costs are spread over all frames of the window
+    double perStep = _stepsTimed ? _stepMs / _stepsTimed : 0.0;
+    double stepMs = perStep * _steps / _frames;
+    double drawMs = _drawsTimed ? _drawMs / _drawsTimed : 0.0;
+    double frameMs = stepMs + drawMs;
+
+    bool changed = false;
+    if (frameMs > QUALITY_OVER * _budget) {
+        changed = degrade (stepMs, drawMs);
+    } else if (frameMs < QUALITY_UNDER * _budget) {
+        changed = improve (stepMs, drawMs);
+    }
+
+    if (changed) {
+        std::stringstream decision;
+        decision << "Quality: " << frameMs << " ms per frame (stepping "
+                 << stepMs << ", drawing " << drawMs << ") for a budget of "
+                 << _budget << " ms, " << _decision;
+        _decision = decision.str ();
+    }
+
+    restart ();
+    if (changed) {
+        _settling = QUALITY_SETTLE_FRAMES;
+    }
+
+    return changed;
+}
+
+const QualitySettings& QualityController::settings () const
+{
+    return _settings;
+}
+
+const std::string& QualityController::decision () const
+{
+    return _decision;
+}
+
+bool QualityController::degrade (double stepMs, double drawMs)
+{
+    std::stringstream decision;
+    if (drawMs > stepMs && _settings.decimation < _least.decimation) {
+        _settings.decimation = std::min (_settings.decimation * 2,
+                                         _least.decimation);
+        decision << "drawing 1/" << _settings.decimation
+                 << " of the particles";
+    } else if (_settings.particles > _least.particles) {
+        _settings.particles = std::max (_settings.particles / 2,
+                                        _least.particles);
+        decision << "simulating " << _settings.particles << " particles";
+    } else if (_settings.subSteps > _least.subSteps) {
+        _settings.subSteps = std::max (_settings.subSteps / 2,
+                                       _least.subSteps);
+        decision << "at most " << _settings.subSteps << " steps per frame";
+    } else if (_settings.decimation < _least.decimation) {
+        _settings.decimation = std::min (_settings.decimation * 2,
+                                         _least.decimation);
+        decision << "drawing 1/" << _settings.decimation
+                 << " of the particles";
+    } else {
+        return false;
+    }
+
+    _decision = decision.str ();
+    return true;
+}
+
+// doubling the particles doubles both costs, more sub-steps only matter if
+// the simulation fell behind and would then cost up to twice as much
+bool QualityController::improve (double stepMs, double drawMs)
+{
+    std::stringstream decision;
+    double fits = QUALITY_HEADROOM * _budget;
+    if (_settings.subSteps < _most.subSteps && 2.0 * stepMs + drawMs < fits) {
+        _settings.subSteps = std::min (_settings.subSteps * 2,
+                                       _most.subSteps);
+        decision << "at most " << _settings.subSteps << " steps per frame";
+    } else if (_settings.particles < _most.particles &&
+               2.0 * (stepMs + drawMs) < fits) {
+        _settings.particles = std::min (_settings.particles * 2,
+                                        _most.particles);
+        decision << "simulating " << _settings.particles << " particles";
+    } else if (_settings.decimation > _most.decimation &&
+               stepMs + 2.0 * drawMs < fits) {
+        _settings.decimation = std::max (_settings.decimation / 2,
+                                         _most.decimation);
+        decision << "drawing 1/" << _settings.decimation
+                 << " of the particles";
+    } else {
+        return false;
+    }
+
+    _decision = decision.str ();
+    return true;
+}
+
+void QualityController::restart ()
+{
+    _stepMs = 0.0;
+    _stepsTimed = 0;
+    _drawMs = 0.0;
+    _drawsTimed = 0;
+    _steps = 0;
+    _frames = 0;
+    _settling = 0;
+}
@@ -0,0 +1,87 @@
+////////////////////////////////////////////////////////////////////////////////
+//3456789 123456789 123456789 123456789 123456789 123456789 123456789 123456789
+//
+// A test trying out OpenGL 3.x's transform-feedback feature with some SDL2.x
+// glue code to make it work on multiple platforms
+//
+// Copyright 2015-2016 Mirco Müller
+//
+// Author(s):
+//   Mirco "MacSlow" Müller <macslow@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _QUALITY_CONTROLLER_H
+#define _QUALITY_CONTROLLER_H
+
+#include <cstddef>
+#include <string>
+
+struct QualitySettings {
+    unsigned int subSteps;   // most simulation-steps per frame
+    size_t particles;        // particles being simulated and drawn
+    unsigned int decimation; // only every decimation-th of them gets drawn
+};
+
+// Holds the frame-time within a budget by trading quality for speed. It's fed
+// how long simulation-steps and drawing took, every QUALITY_WINDOW frames it
+// compares their mean per frame to the budget and changes one setting at a
+// time: over budget it draws fewer particles if drawing costs more than
+// stepping, otherwise simulates fewer of them and then takes fewer sub-steps,
+// under budget it restores them in reverse order once they'd fit again.
+class QualityController
+{
+    public:
+        // budget in milliseconds per frame
+        explicit QualityController (double budget);
+        ~QualityController ();
+
+        // the range the settings are kept in, starts over at most quality
+        // whenever it changes
+        void setLimits (const QualitySettings& most,
+                        const QualitySettings& least);
+
+        // milliseconds taken by steps simulation-steps, or one frame's drawing
+        void addSteps (double milliseconds, unsigned int steps);
+        void addDraw (double milliseconds);
+
+        // call once per frame with the number of steps it took, true if the
+        // settings changed, decision () says why
+        bool endFrame (unsigned int steps);
+
+        const QualitySettings& settings () const;
+        const std::string& decision () const;
+
+    private:
+        bool degrade (double stepMs, double drawMs);
+        bool improve (double stepMs, double drawMs);
+        void restart ();
+
+        double _budget;
+        QualitySettings _most;
+        QualitySettings _least;
+        QualitySettings _settings;
+        std::string _decision;
+
+        double _stepMs;
+        unsigned int _stepsTimed;
+        double _drawMs;
+        unsigned int _drawsTimed;
+        unsigned int _steps;
+        unsigned int _frames;
+        unsigned int _settling;
+};
+
+#endif // _QUALITY_CONTROLLER_H
@@ -0,0 +1,131 @@
+////////////////////////////////////////////////////////////////////////////////
+//3456789 123456789 123456789 123456789 123456789 123456789 123456789 123456789
+//
+// A test trying out OpenGL 3.x's transform-feedback feature with some SDL2.x
+// glue code to make it work on multiple platforms
+//
+// Copyright 2015-2016 Mirco Müller
+//
+// Author(s):
+//   Mirco "MacSlow" Müller <macslow@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _RADIX_SORT_H
+#define _RADIX_SORT_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "thread-pool.h"
+
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+
+// LSD radix-sort of the lower keyBits of keys, values get the same moves, so
+// with values = 0, 1, 2, ... they end up as the sorting permutation. Every
+// chunk counts its digits on its own and then scatters to offsets computed
+// from all the counts, which keeps each pass stable without any atomics. The
+// *Tmp-vectors are scratch-space of the same size, histograms is resized as
+// needed, the sorted result ends up in keys and values.
+template <typename Key>
+void radixSort (ThreadPool& pool,
+                size_t chunkSize,
+                unsigned int keyBits,
+                std::vector<Key>& keys,
+                std::vector<Key>& keysTmp,
+                std::vector<uint32_t>& values,
+                std::vector<uint32_t>& valuesTmp,
+                std::vector<uint32_t>& histograms)
+{
+    size_t count = keys.size ();
+    if (count == 0) {
+        return;
+    }
+    size_t numChunks = (count + chunkSize - 1) / chunkSize;
+
+    // a single call may cover several chunks if the pool doesn't split
+    auto forEachChunk = [&] (size_t begin,
+                             size_t end,
+                             const std::function<void (size_t,
+                                                       size_t,
+                                                       size_t)>& func) {
+        for (size_t chunk = begin / chunkSize;
+             chunk * chunkSize < end;
+             ++chunk) {
+            size_t first = chunk * chunkSize;
+            size_t last = std::min (first + chunkSize, count);
+            func (chunk, first, last);
+        }
+    };
+
+    for (unsigned int shift = 0; shift < keyBits; shift += RADIX_BITS) {
+        histograms.assign (numChunks * RADIX_BUCKETS, 0);
+        pool.parallelFor (count, chunkSize, [&] (size_t begin, size_t end) {
+            forEachChunk (begin, end, [&] (size_t chunk,
+                                           size_t first,
+                                           size_t last) {
+                uint32_t* histogram = &histograms[chunk * RADIX_BUCKETS];
+                for (size_t i = first; i < last; ++i) {
+                    ++histogram[(keys[i] >> shift) & (RADIX_BUCKETS - 1)];
+                }
+            });
+        });
+
+        // nothing to do if all keys share this digit, which is common for
+        // the upper digits once they're clumped together
+        size_t first = (keys[0] >> shift) & (RADIX_BUCKETS - 1);
+        size_t same = 0;
+        for (size_t chunk = 0; chunk < numChunks; ++chunk) {
+            same += histograms[chunk * RADIX_BUCKETS + first];
+        }
+        if (same == count) {
+            continue;
+        }
+
+        uint32_t offset = 0;
+        for (size_t digit = 0; digit < RADIX_BUCKETS; ++digit) {
+            for (size_t chunk = 0; chunk < numChunks; ++chunk) {
+                uint32_t& entry = histograms[chunk * RADIX_BUCKETS + digit];
+                uint32_t digitCount = entry;
+                entry = offset;
+                offset += digitCount;
+            }
+        }
+
+        pool.parallelFor (count, chunkSize, [&] (size_t begin, size_t end) {
+            forEachChunk (begin, end, [&] (size_t chunk,
+                                           size_t first,
+                                           size_t last) {
+                uint32_t* offsets = &histograms[chunk * RADIX_BUCKETS];
+                for (size_t i = first; i < last; ++i) {
+                    uint32_t target = offsets[(keys[i] >> shift) &
+                                              (RADIX_BUCKETS - 1)]++;
+                    keysTmp[target] = keys[i];
+                    valuesTmp[target] = values[i];
+                }
+            });
+        });
+
+        std::swap (keys, keysTmp);
+        std::swap (values, valuesTmp);
+    }
+}
+
+#endif // _RADIX_SORT_H
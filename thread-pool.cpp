@@ -0,0 +1,167 @@
+////////////////////////////////////////////////////////////////////////////////
+//3456789 123456789 123456789 123456789 123456789 123456789 123456789 123456789
+//
+// A test trying out OpenGL 3.x's transform-feedback feature with some SDL2.x
+// glue code to make it work on multiple platforms
+//
+// Copyright 2015-2016 Mirco Müller
+//
+// Author(s):
+//   Mirco "MacSlow" Müller <macslow@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cassert>
+
+#include "thread-pool.h"
+
+static unsigned int defaultNumThreads ()
+{
+    unsigned int numThreads = std::thread::hardware_concurrency ();
+    return numThreads ? numThreads : 1;
+}
+
+ThreadPool::ThreadPool (unsigned int numThreads)
+    : _numWorkers (numThreads ? numThreads : defaultNumThreads ())
+    , _queues (_numWorkers)
+    , _job (nullptr)
+    , _remaining (0)
+    , _generation (0)
+    , _stop (false)
+{
+    for (unsigned int i = 1; i < _numWorkers; ++i) {
+        _threads.push_back (std::thread (&ThreadPool::workerLoop, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool ()
+{
+    {
+        std::lock_guard<std::mutex> lock (_mutex);
+        _stop = true;
+    }
+    _wake.notify_all ();
+
+    for (auto& thread : _threads) {
+        thread.join ();
+    }
+}
+
+unsigned int ThreadPool::size () const
+{
+    return _numWorkers;
+}
+
+void ThreadPool::parallelFor (size_t count,
+                              size_t chunkSize,
+                              const std::function<void (size_t, size_t)>& func)
+{
+    if (count == 0) {
+        return;
+    }
+
+    if (chunkSize == 0) {
+        chunkSize = 1;
+    }
+
+    size_t numChunks = (count + chunkSize - 1) / chunkSize;
+    if (_numWorkers == 1 || numChunks == 1) {
+        func (0, count);
+        return;
+    }
+
+    assert (_job == nullptr); // no nested or concurrent parallelFor()
+    _job = &func;
+    _remaining = numChunks;
+
+    // hand every worker a contiguous run of chunks to keep memory-access local
+    for (unsigned int worker = 0; worker < _numWorkers; ++worker) {
+        size_t first = numChunks * worker / _numWorkers;
+        size_t last = numChunks * (worker + 1) / _numWorkers;
+        std::lock_guard<std::mutex> lock (_queues[worker].mutex);
+        for (size_t chunk = first; chunk < last; ++chunk) {
+            size_t begin = chunk * chunkSize;
+            size_t end = begin + chunkSize < count ? begin + chunkSize : count;
+            _queues[worker].chunks.push_back (Chunk (begin, end));
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock (_mutex);
+        ++_generation;
+    }
+    _wake.notify_all ();
+
+    runChunks (0);
+
+    std::unique_lock<std::mutex> lock (_mutex);
+    _done.wait (lock, [this] { return _remaining == 0; });
+    _job = nullptr;
+}
+
+void ThreadPool::workerLoop (unsigned int index)
+{
+    unsigned long seen = 0;
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock (_mutex);
+            _wake.wait (lock, [&] { return _stop || _generation != seen; });
+            if (_stop) {
+                return;
+            }
+            seen = _generation;
+        }
+
+        runChunks (index);
+    }
+}
+
+bool ThreadPool::popChunk (unsigned int index, Chunk& chunk)
+{
+    {
+        Queue& own = _queues[index];
+        std::lock_guard<std::mutex> lock (own.mutex);
+        if (!own.chunks.empty ()) {
+            chunk = own.chunks.back ();
+            own.chunks.pop_back ();
+            return true;
+        }
+    }
+
+    for (unsigned int i = 1; i < _numWorkers; ++i) {
+        Queue& victim = _queues[(index + i) % _numWorkers];
+        std::lock_guard<std::mutex> lock (victim.mutex);
+        if (!victim.chunks.empty ()) {
+            chunk = victim.chunks.front ();
+            victim.chunks.pop_front ();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ThreadPool::runChunks (unsigned int index)
+{
+    Chunk chunk;
+    while (popChunk (index, chunk)) {
+        (*_job) (chunk.first, chunk.second);
+        if (_remaining.fetch_sub (1) == 1) {
+            std::lock_guard<std::mutex> lock (_mutex);
+            _done.notify_all ();
+        }
+    }
+}
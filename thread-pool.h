@@ -0,0 +1,82 @@
+////////////////////////////////////////////////////////////////////////////////
+//3456789 123456789 123456789 123456789 123456789 123456789 123456789 123456789
+//
+// A test trying out OpenGL 3.x's transform-feedback feature with some SDL2.x
+// glue code to make it work on multiple platforms
+//
+// Copyright 2015-2016 Mirco Müller
+//
+// Author(s):
+//   Mirco "MacSlow" Müller <macslow@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _THREAD_POOL_H
+#define _THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// A fixed set of worker-threads running parallel for-loops split into chunks.
+// Every worker owns a queue of chunks, pops its own from the back and steals
+// from the front of the others' once it runs dry, so uneven chunks (e.g.
+// particles stuck at the boundaries) don't leave cores idle. The calling
+// thread takes part as worker 0, so a pool of size 1 spawns no threads.
+class ThreadPool
+{
+    public:
+        explicit ThreadPool (unsigned int numThreads = 0);
+        ~ThreadPool ();
+
+        unsigned int size () const;
+
+        // calls func (begin, end) for all chunks of [0, count) of at most
+        // chunkSize elements and returns once all of them are done
+        void parallelFor (size_t count,
+                          size_t chunkSize,
+                          const std::function<void (size_t, size_t)>& func);
+
+    private:
+        typedef std::pair<size_t, size_t> Chunk;
+
+        struct Queue {
+            std::mutex mutex;
+            std::deque<Chunk> chunks;
+        };
+
+        void workerLoop (unsigned int index);
+        bool popChunk (unsigned int index, Chunk& chunk);
+        void runChunks (unsigned int index);
+
+        unsigned int _numWorkers;
+        std::vector<std::thread> _threads;
+        std::vector<Queue> _queues;
+        const std::function<void (size_t, size_t)>* _job;
+        std::atomic<size_t> _remaining;
+        unsigned long _generation;
+        bool _stop;
+        std::mutex _mutex;
+        std::condition_variable _wake;
+        std::condition_variable _done;
+};
+
+#endif // _THREAD_POOL_H
@@ -0,0 +1,304 @@
+////////////////////////////////////////////////////////////////////////////////
+//3456789 123456789 123456789 123456789 123456789 123456789 123456789 123456789
+//
+// A test trying out OpenGL 3.x's transform-feedback feature with some SDL2.x
+// glue code to make it work on multiple platforms
+//
+// Copyright 2015-2016 Mirco Müller
+//
+// Author(s):
+//   Mirco "MacSlow" Müller <macslow@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "trace.h"
+
+// GPU-spans in flight at most, further ones are dropped instead of waited for
+#define GPU_TRACE_RING_SIZE 256
+
+#define CPU_TRACE_TID 1
+#define GPU_TRACE_TID 2
+
+struct TraceEvent {
+    const char* name;
+    int tid;
+    long long begin; // microseconds
+    long long duration;
+};
+
+struct GpuSpan {
+    const char* name;
+    GLuint queries[2];
+    bool pending;
+};
+
+static bool tracing = false;
+static std::string traceFilename;
+static std::vector<TraceEvent> events;
+static std::mutex eventsMutex;
+
+static bool gpuTracing = false;
+static GpuSpan gpuRing[GPU_TRACE_RING_SIZE];
+static int gpuHead = 0;
+static int gpuTail = 0;
+static long long gpuOffset = 0;
+static unsigned long droppedGpuSpans = 0;
+
+static long long now ()
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds> (
+               steady_clock::now ().time_since_epoch ()).count ();
+}
+
+static void addEvent (const char* name,
+                      int tid,
+                      long long begin,
+                      long long duration)
+{
+    TraceEvent event = {name, tid, begin, duration};
+    std::lock_guard<std::mutex> lock (eventsMutex);
+    events.push_back (event);
+}
+
+bool startTrace (const char* filename)
+{
+    std::ofstream file (filename);
+    if (!file) {
+        std::cout << "Failed to open trace-file " << filename << std::endl;
+        return false;
+    }
+
+    traceFilename = filename;
+    events.reserve (1 << 16);
+    tracing = true;
+
+    return true;
+}
+
+void startGpuTrace ()
+{
+    if (!tracing || !(GLEW_VERSION_3_3 || GLEW_ARB_timer_query)) {
+        return;
+    }
+
+    for (int i = 0; i < GPU_TRACE_RING_SIZE; ++i) {
+        glGenQueries (2, gpuRing[i].queries);
+        gpuRing[i].pending = false;
+    }
+
+    // the GPU's clock has its own epoch, line it up with the CPU's once
+    GLint64 gpuNow = 0;
+    glGetInteger64v (GL_TIMESTAMP, &gpuNow);
+    gpuOffset = now () - gpuNow / 1000;
+    gpuTracing = true;
+}
+
+void collectGpuTrace ()
+{
+    if (!gpuTracing) {
+        return;
+    }
+
+    // spans finish in order, so stop at the first one that isn't done yet
+    while (gpuRing[gpuTail].pending) {
+        GpuSpan& span = gpuRing[gpuTail];
+        GLint available = 0;
+        glGetQueryObjectiv (span.queries[1],
+                            GL_QUERY_RESULT_AVAILABLE,
+                            &available);
+        if (!available) {
+            break;
+        }
+
+        GLuint64 begin = 0;
+        GLuint64 end = 0;
+        glGetQueryObjectui64v (span.queries[0], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v (span.queries[1], GL_QUERY_RESULT, &end);
+        addEvent (span.name,
+                  GPU_TRACE_TID,
+                  (long long) (begin / 1000) + gpuOffset,
+                  (long long) ((end - begin) / 1000));
+        span.pending = false;
+        gpuTail = (gpuTail + 1) % GPU_TRACE_RING_SIZE;
+    }
+}
+
+static void writeJsonString (std::ostream& out, const char* str)
+{
+    out << '"';
+    for (const char* c = str; *c; ++c) {
+        if (*c == '"' || *c == '\\') {
+            out << '\\';
+        }
+        out << *c;
+    }
+    out << '"';
+}
+
+void stopTrace ()
+{
+    if (!tracing) {
+        return;
+    }
+
+    if (gpuTracing) {
+        glFinish ();
+        collectGpuTrace ();
+        for (int i = 0; i < GPU_TRACE_RING_SIZE; ++i) {
+            glDeleteQueries (2, gpuRing[i].queries);
+        }
+        gpuTracing = false;
+        if (droppedGpuSpans) {
+            std::cout << "dropped " << droppedGpuSpans
+                      << " GPU-spans, the GPU was too far behind" << std::endl;
+        }
+    }
+    tracing = false;
+
+    std::ofstream file (traceFilename.c_str ());
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+         << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+         << CPU_TRACE_TID << ",\"args\":{\"name\":\"CPU\"}},\n"
+         << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+         << GPU_TRACE_TID << ",\"args\":{\"name\":\"GPU\"}}";
+    for (const TraceEvent& event : events) {
+        file << ",\n{\"name\":";
+        writeJsonString (file, event.name);
+        file << ",\"cat\":\"" << (event.tid == GPU_TRACE_TID ? "gpu" : "cpu")
+             << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.tid
+             << ",\"ts\":" << event.begin << ",\"dur\":" << event.duration
+             << "}";
+    }
+    file << "\n]}\n";
+
+    std::cout << "wrote " << events.size () << " trace-events to "
+              << traceFilename << std::endl;
+    events.clear ();
+}
+
+TraceScope::TraceScope (const char* name) :
+    _name (name),
+    _begin (tracing ? now () : 0)
+{
+}
+
+TraceScope::~TraceScope ()
+{
+    if (tracing) {
+        addEvent (_name, CPU_TRACE_TID, _begin, now () - _begin);
+    }
+}
+
+GpuTraceScope::GpuTraceScope (const char* name) :
+    _slot (-1)
+{
+    if (!gpuTracing) {
+        return;
+    }
+
+    if (gpuRing[gpuHead].pending) {
+        ++droppedGpuSpans;
+        return;
+    }
+
+    _slot = gpuHead;
+    gpuRing[_slot].name = name;
+    gpuRing[_slot].pending = true;
+    glQueryCounter (gpuRing[_slot].queries[0], GL_TIMESTAMP);
+    gpuHead = (gpuHead + 1) % GPU_TRACE_RING_SIZE;
+}
+
+GpuTraceScope::~GpuTraceScope ()
+{
+    if (_slot >= 0) {
+        glQueryCounter (gpuRing[_slot].queries[1], GL_TIMESTAMP);
+    }
+}
+
+GpuTimer::GpuTimer () :
+    _head (0),
+    _tail (0),
+    _pending (0),
+    _running (false)
+{
+    glGenQueries (GPU_TIMER_QUERIES, _queries);
+}
+
+GpuTimer::~GpuTimer ()
+{
+    glDeleteQueries (GPU_TIMER_QUERIES, _queries);
+}
+
+bool GpuTimer::available ()
+{
+    return GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+}
+
+void GpuTimer::begin ()
+{
+    if (_pending == GPU_TIMER_QUERIES) {
+        return;
+    }
+
+    glBeginQuery (GL_TIME_ELAPSED, _queries[_head]);
+    _running = true;
+}
+
+void GpuTimer::end (unsigned int count)
+{
+    if (!_running) {
+        return;
+    }
+
+    glEndQuery (GL_TIME_ELAPSED);
+    _counts[_head] = count;
+    _head = (_head + 1) % GPU_TIMER_QUERIES;
+    ++_pending;
+    _running = false;
+}
+
+bool GpuTimer::poll (double* milliseconds, unsigned int* count)
+{
+    if (_pending == 0) {
+        return false;
+    }
+
+    GLint available = 0;
+    glGetQueryObjectiv (_queries[_tail], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+        return false;
+    }
+
+    GLuint64 elapsed = 0;
+    glGetQueryObjectui64v (_queries[_tail], GL_QUERY_RESULT, &elapsed);
+    *milliseconds = elapsed / 1e6;
+    if (count) {
+        *count = _counts[_tail];
+    }
+    _tail = (_tail + 1) % GPU_TIMER_QUERIES;
+    --_pending;
+
+    return true;
+}
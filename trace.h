@@ -0,0 +1,100 @@
+////////////////////////////////////////////////////////////////////////////////
+//3456789 123456789 123456789 123456789 123456789 123456789 123456789 123456789
+//
+// A test trying out OpenGL 3.x's transform-feedback feature with some SDL2.x
+// glue code to make it work on multiple platforms
+//
+// Copyright 2015-2016 Mirco Müller
+//
+// Author(s):
+//   Mirco "MacSlow" Müller <macslow@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+// Timeline of where each frame's time goes, written as Chrome's trace-event
+// JSON (load it in chrome://tracing or ui.perfetto.dev). CPU-spans are taken
+// with the steady clock, GPU-spans with GL_TIMESTAMP queries that are read
+// back frames later once they're available, so tracing never stalls the GPU.
+
+// starts recording CPU-spans, nothing is recorded unless this was called
+bool startTrace (const char* filename);
+
+// needs a current OpenGL-context with ARB_timer_query (or GL 3.3)
+void startGpuTrace ();
+
+// reads back all GPU-spans whose results are available, call once per frame
+void collectGpuTrace ();
+
+// waits for all outstanding GPU-spans and writes the trace-file
+void stopTrace ();
+
+// GpuTimer-queries in flight at most
+#define GPU_TIMER_QUERIES 8
+
+class TraceScope
+{
+    public:
+        explicit TraceScope (const char* name);
+        ~TraceScope ();
+
+    private:
+        const char* _name;
+        long long _begin;
+};
+
+class GpuTraceScope
+{
+    public:
+        explicit GpuTraceScope (const char* name);
+        ~GpuTraceScope ();
+
+    private:
+        int _slot;
+};
+
+// Measures how long the GPU takes for what's issued between begin () and
+// end (), with GL_TIME_ELAPSED queries that are polled for later on, so it
+// never stalls either. They can't nest, nor overlap with another GpuTimer.
+class GpuTimer
+{
+    public:
+        GpuTimer ();
+        ~GpuTimer ();
+
+        // needs a current OpenGL-context with ARB_timer_query (or GL 3.3)
+        static bool available ();
+
+        // begin () does nothing while all queries are still waited for,
+        // count is how many units of work (e.g. steps) were measured
+        void begin ();
+        void end (unsigned int count = 1);
+
+        // the oldest finished measurement in milliseconds and its count,
+        // false if none
+        bool poll (double* milliseconds, unsigned int* count = nullptr);
+
+    private:
+        unsigned int _queries[GPU_TIMER_QUERIES];
+        unsigned int _counts[GPU_TIMER_QUERIES];
+        int _head;
+        int _tail;
+        int _pending;
+        bool _running;
+};
+
+#endif // _TRACE_H
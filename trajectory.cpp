@@ -0,0 +1,350 @@
+////////////////////////////////////////////////////////////////////////////////
+//3456789 123456789 123456789 123456789 123456789 123456789 123456789 123456789
+//
+// A test trying out OpenGL 3.x's transform-feedback feature with some SDL2.x
+// glue code to make it work on multiple platforms
+//
+// Copyright 2015-2016 Mirco Müller
+//
+// Author(s):
+//   Mirco "MacSlow" Müller <macslow@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#include "trajectory.h"
+
+// enough to keep a couple of captures in flight while the writer catches up
+#define TRAJECTORY_RING_SIZE 3
+
+// a key-frame every so often lets readers seek without decoding everything
+#define TRAJECTORY_KEY_INTERVAL 64
+
+TrajectoryRecorder::TrajectoryRecorder ()
+    : _interval (1)
+    , _limit (1.0f)
+    , _delta (false)
+    , _steps (0)
+    , _lastCapture (0)
+    , _frames (0)
+    , _dropped (0)
+    , _next (0)
+    , _pending (0)
+    , _stop (false)
+    , _written (0)
+    , _failed (false)
+{
+}
+
+TrajectoryRecorder::~TrajectoryRecorder ()
+{
+    close ();
+}
+
+bool TrajectoryRecorder::open (const char* filename,
+                               unsigned int interval,
+                               float limit,
+                               bool delta)
+{
+    close ();
+
+    _file.open (filename, std::ios::binary | std::ios::trunc);
+    if (!_file) {
+        std::cout << "Failed to create trajectory " << filename << std::endl;
+        return false;
+    }
+
+    TrajectoryHeader header;
+    std::memset (&header, 0, sizeof (header));
+    std::memcpy (header.magic, TRAJECTORY_MAGIC, sizeof (header.magic));
+    header.version = TRAJECTORY_VERSION;
+    header.interval = interval > 0 ? interval : 1;
+    header.limit = limit;
+    header.delta = delta ? 1 : 0;
+    _file.write ((const char*) &header, sizeof (header));
+
+    _interval = header.interval;
+    _limit = limit;
+    _delta = delta;
+    _steps = 0;
+    _lastCapture = 0;
+    _frames = 0;
+    _dropped = 0;
+    _written = 0;
+    _failed = false;
+    _stop = false;
+    _next = 0;
+    _pending = 0;
+    _slots.resize (TRAJECTORY_RING_SIZE);
+    for (Slot& slot : _slots) {
+        std::memset (&slot, 0, sizeof (slot));
+        glGenBuffers (1, &slot.buffer);
+        slot.state = FreeSlot;
+    }
+
+    _writer = std::thread (&TrajectoryRecorder::writerLoop, this);
+
+    return true;
+}
+
+void TrajectoryRecorder::close ()
+{
+    if (!_writer.joinable ()) {
+        return;
+    }
+
+    // oldest first, so the writer still sees the frames in order
+    for (size_t i = 0; i < _slots.size (); ++i) {
+        Slot& slot = _slots[(_pending + i) % _slots.size ()];
+        if (stateOf (slot) != CopyingSlot) {
+            continue;
+        }
+        while (glClientWaitSync (slot.fence,
+                                 GL_SYNC_FLUSH_COMMANDS_BIT,
+                                 1000000000) == GL_TIMEOUT_EXPIRED) {
+        }
+        finishCopy (slot);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock (_mutex);
+        _stop = true;
+    }
+    _wake.notify_one ();
+    _writer.join ();
+
+    for (Slot& slot : _slots) {
+        if (stateOf (slot) == WrittenSlot) {
+            glBindBuffer (GL_COPY_READ_BUFFER, slot.buffer);
+            glUnmapBuffer (GL_COPY_READ_BUFFER);
+            glBindBuffer (GL_COPY_READ_BUFFER, 0);
+        }
+        glDeleteBuffers (1, &slot.buffer);
+    }
+    _slots.clear ();
+    _file.close ();
+
+    std::cout << "Recorded " << _written << " trajectory-frames, dropped "
+              << _dropped << (_failed ? ", writing failed" : "")
+              << std::endl;
+}
+
+void TrajectoryRecorder::stepped (GLuint buffer,
+                                  size_t count,
+                                  size_t stride,
+                                  bool packed,
+                                  unsigned int steps)
+{
+    if (_slots.empty ()) {
+        return;
+    }
+
+    _steps += steps;
+    if (_steps - _lastCapture < _interval) {
+        return;
+    }
+    _lastCapture = _steps - _steps % _interval;
+
+    poll ();
+    capture (buffer, count, stride, packed);
+}
+
+void TrajectoryRecorder::capture (GLuint buffer,
+                                  size_t count,
+                                  size_t stride,
+                                  bool packed)
+{
+    Slot& slot = _slots[_next];
+    if (stateOf (slot) != FreeSlot) {
+        ++_dropped;
+        return;
+    }
+
+    GLsizeiptr size = (GLsizeiptr) (count * stride);
+    glBindBuffer (GL_COPY_READ_BUFFER, buffer);
+    glBindBuffer (GL_COPY_WRITE_BUFFER, slot.buffer);
+    if (slot.size != size) {
+        glBufferData (GL_COPY_WRITE_BUFFER, size, nullptr, GL_STREAM_READ);
+        slot.size = size;
+    }
+    glCopyBufferSubData (GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, size);
+    glBindBuffer (GL_COPY_WRITE_BUFFER, 0);
+    glBindBuffer (GL_COPY_READ_BUFFER, 0);
+
+    slot.fence = glFenceSync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot.count = count;
+    slot.stride = stride;
+    slot.packed = packed;
+    slot.step = _steps;
+    setState (slot, CopyingSlot);
+    _next = (_next + 1) % _slots.size ();
+}
+
+void TrajectoryRecorder::poll ()
+{
+    if (_slots.empty ()) {
+        return;
+    }
+
+    // captures complete in order, so stop at the first one still copying
+    while (stateOf (_slots[_pending]) == CopyingSlot) {
+        Slot& slot = _slots[_pending];
+        if (glClientWaitSync (slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) ==
+            GL_TIMEOUT_EXPIRED) {
+            break;
+        }
+        finishCopy (slot);
+        _pending = (_pending + 1) % _slots.size ();
+    }
+
+    // mapping and unmapping has to happen on the GL-thread
+    for (Slot& slot : _slots) {
+        if (stateOf (slot) == WrittenSlot) {
+            glBindBuffer (GL_COPY_READ_BUFFER, slot.buffer);
+            glUnmapBuffer (GL_COPY_READ_BUFFER);
+            glBindBuffer (GL_COPY_READ_BUFFER, 0);
+            slot.data = nullptr;
+            setState (slot, FreeSlot);
+        }
+    }
+}
+
+// the writer-thread changes the states of slots as well, so they're only
+// ever read or written with the _mutex held
+TrajectoryRecorder::SlotState TrajectoryRecorder::stateOf (const Slot& slot)
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    return slot.state;
+}
+
+void TrajectoryRecorder::setState (Slot& slot, SlotState state)
+{
+    std::lock_guard<std::mutex> lock (_mutex);
+    slot.state = state;
+}
+
+void TrajectoryRecorder::finishCopy (Slot& slot)
+{
+    glDeleteSync (slot.fence);
+    slot.fence = 0;
+
+    glBindBuffer (GL_COPY_READ_BUFFER, slot.buffer);
+    slot.data = (const unsigned char*) glMapBufferRange (GL_COPY_READ_BUFFER,
+                                                         0,
+                                                         slot.size,
+                                                         GL_MAP_READ_BIT);
+    glBindBuffer (GL_COPY_READ_BUFFER, 0);
+    if (!slot.data) {
+        ++_dropped;
+        setState (slot, FreeSlot);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock (_mutex);
+        slot.state = WritingSlot;
+        _queue.push_back ((size_t) (&slot - _slots.data ()));
+    }
+    ++_frames;
+    _wake.notify_one ();
+}
+
+void TrajectoryRecorder::writerLoop ()
+{
+    for (;;) {
+        size_t index = 0;
+        {
+            std::unique_lock<std::mutex> lock (_mutex);
+            _wake.wait (lock, [this] { return _stop || !_queue.empty (); });
+            if (_queue.empty ()) {
+                return;
+            }
+            index = _queue.front ();
+            _queue.pop_front ();
+        }
+
+        writeFrame (_slots[index]);
+
+        std::lock_guard<std::mutex> lock (_mutex);
+        _slots[index].state = WrittenSlot;
+    }
+}
+
+static void appendVarint (std::vector<unsigned char>& out, uint32_t value)
+{
+    while (value >= 0x80) {
+        out.push_back ((unsigned char) (value | 0x80));
+        value >>= 7;
+    }
+    out.push_back ((unsigned char) value);
+}
+
+void TrajectoryRecorder::writeFrame (const Slot& slot)
+{
+    size_t components = 3 * slot.count;
+    _current.resize (components);
+    for (size_t i = 0; i < slot.count; ++i) {
+        const unsigned char* particle = slot.data + i * slot.stride;
+        uint16_t* out = &_current[3 * i];
+        if (slot.packed) {
+            std::memcpy (out, particle, 3 * sizeof (uint16_t));
+            continue;
+        }
+
+        float position[3];
+        std::memcpy (position, particle, sizeof (position));
+        for (int c = 0; c < 3; ++c) {
+            float n = .5f * position[c] / _limit + .5f;
+            n = n < 0.0f ? 0.0f : (n > 1.0f ? 1.0f : n);
+            out[c] = (uint16_t) std::lround (n * 65535.0f);
+        }
+    }
+
+    TrajectoryFrame frame;
+    std::memset (&frame, 0, sizeof (frame));
+    frame.step = slot.step;
+    frame.numParticles = slot.count;
+    frame.keyFrame = !_delta ||
+                     _previous.size () != components ||
+                     _written % TRAJECTORY_KEY_INTERVAL == 0;
+
+    _payload.clear ();
+    if (frame.keyFrame) {
+        const unsigned char* bytes = (const unsigned char*) _current.data ();
+        _payload.assign (bytes, bytes + components * sizeof (uint16_t));
+    } else {
+        // slow particles barely move between frames, so most deltas end up
+        // as a single byte
+        for (size_t i = 0; i < components; ++i) {
+            int16_t delta = (int16_t) (uint16_t) (_current[i] - _previous[i]);
+            uint32_t zigzag = delta < 0 ? 2u * (uint32_t) -(delta + 1) + 1u :
+                                          2u * (uint32_t) delta;
+            appendVarint (_payload, zigzag);
+        }
+    }
+    frame.payloadBytes = _payload.size ();
+
+    _file.write ((const char*) &frame, sizeof (frame));
+    _file.write ((const char*) _payload.data (), _payload.size ());
+    if (!_file) {
+        _failed = true;
+    }
+
+    std::swap (_previous, _current);
+    ++_written;
+}
@@ -0,0 +1,150 @@
+////////////////////////////////////////////////////////////////////////////////
+//3456789 123456789 123456789 123456789 123456789 123456789 123456789 123456789
+//
+// A test trying out OpenGL 3.x's transform-feedback feature with some SDL2.x
+// glue code to make it work on multiple platforms
+//
+// Copyright 2015-2016 Mirco Müller
+//
+// Author(s):
+//   Mirco "MacSlow" Müller <macslow@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License version 3, as published
+// by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranties of
+// MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+// PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _TRAJECTORY_H
+#define _TRAJECTORY_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <GL/glew.h>
+
+#define TRAJECTORY_MAGIC   "TFTRAJ1"
+#define TRAJECTORY_VERSION 1
+
+// A trajectory-file starts with a TrajectoryHeader followed by one frame per
+// recorded step, each a TrajectoryFrame plus payloadBytes of positions. Those
+// are quantized to unsigned 16 bits per component relative to [-limit, limit],
+// a key-frame stores them as is (x, y, z per particle), a delta-frame as the
+// zigzag-encoded LEB128-varint of the (wrapping) difference to the previous
+// frame's value. All values are in the host's native byte-order.
+struct TrajectoryHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t interval; // steps between two frames
+    float limit;
+    uint32_t delta;    // non-zero if delta-frames are used
+};
+
+struct TrajectoryFrame {
+    uint64_t step;
+    uint64_t numParticles;
+    uint32_t keyFrame;
+    uint32_t reserved;
+    uint64_t payloadBytes;
+};
+
+// Records the particle-positions every interval steps without stalling the
+// pipeline. A capture is a GPU-side copy of the particle-buffer into the next
+// of a ring of staging-buffers, guarded by a fence. poll() maps the buffers
+// whose fence signaled and hands them to a writer-thread, which encodes and
+// appends them to the file. Captures that find the ring full are dropped
+// rather than waited for.
+class TrajectoryRecorder
+{
+    public:
+        TrajectoryRecorder ();
+        ~TrajectoryRecorder ();
+
+        bool open (const char* filename,
+                   unsigned int interval,
+                   float limit,
+                   bool delta);
+
+        // waits for all outstanding captures, needs the GL-context current
+        void close ();
+
+        // call after the simulation advanced buffer by steps, every particle
+        // takes stride bytes and starts with its position as 3 floats or as
+        // 3 normalized unsigned shorts if packed is true
+        void stepped (GLuint buffer,
+                      size_t count,
+                      size_t stride,
+                      bool packed,
+                      unsigned int steps = 1);
+
+        // hands finished captures to the writer, call once per frame
+        void poll ();
+
+    private:
+        enum SlotState {
+            FreeSlot,
+            CopyingSlot,
+            WritingSlot,
+            WrittenSlot
+        };
+
+        struct Slot {
+            GLuint buffer;
+            GLsizeiptr size;
+            GLsync fence;
+            SlotState state;
+            const unsigned char* data;
+            size_t count;
+            size_t stride;
+            bool packed;
+            uint64_t step;
+        };
+
+        void capture (GLuint buffer, size_t count, size_t stride, bool packed);
+        void finishCopy (Slot& slot);
+        SlotState stateOf (const Slot& slot);
+        void setState (Slot& slot, SlotState state);
+        void writerLoop ();
+        void writeFrame (const Slot& slot);
+
+        std::ofstream _file;
+        unsigned int _interval;
+        float _limit;
+        bool _delta;
+        uint64_t _steps;
+        uint64_t _lastCapture;
+        uint64_t _frames;
+        uint64_t _dropped;
+        std::vector<Slot> _slots;
+        size_t _next;
+        size_t _pending;
+
+        std::thread _writer;
+        std::mutex _mutex;
+        std::condition_variable _wake;
+        std::deque<size_t> _queue;
+        bool _stop;
+
+        // only touched by the writer-thread
+        std::vector<uint16_t> _previous;
+        std::vector<uint16_t> _current;
+        std::vector<unsigned char> _payload;
+        uint64_t _written;
+        bool _failed;
+};
+
+#endif // _TRAJECTORY_H
@@ -29,8 +29,23 @@
 #include <chrono>
 #include <random>
 #include <iostream>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <map>
+#include <sys/resource.h>
 
 #include "utils.h"
+#include "headless.h"
+#include "cpu-simulation.h"
+#include "barnes-hut.h"
+#include "gravity-sources.h"
+#include "trace.h"
+#include "checkpoint.h"
+#include "trajectory.h"
+#include "program-cache.h"
+#include "morton-order.h"
+#include "quality-controller.h"
 
 enum VertexAttribs {
     PositionAttr,
@@ -44,41 +59,102 @@ enum VertexAttribs {
 #define WIN_WIDTH 700
 #define WIN_HEIGHT 700
 #define CUBE_SIZE 100
-#define NUM_PARTICLES (CUBE_SIZE * CUBE_SIZE * CUBE_SIZE)
+#define DEFAULT_NUM_PARTICLES (CUBE_SIZE * CUBE_SIZE * CUBE_SIZE)
 #define NUM_FLOATS_PER_VERTEX 7
-#define MAX_ELEMENTS (NUM_PARTICLES * NUM_FLOATS_PER_VERTEX)
+#define NUM_BYTES_PER_PACKED_VERTEX 12
 #define Z_NEAR 0.1
 #define Z_FAR 100.0
 #define FOV 60.0
 #define BLACK_HOLE_MASS 100000.0
+#define DEFAULT_TIME_STEP 0.05f
+#define DEFAULT_STEP_RATE 60
+#define DEFAULT_MAX_SUB_STEPS 32
+#define DEFAULT_CHECKPOINT_FILE "transform-feedback.ckpt"
+#define DEFAULT_RECORD_INTERVAL 10
+#define DEFAULT_SHADER_CACHE_DIR "transform-feedback.shaders"
+#define DEFAULT_STATE_BUFFERS 3
+#define MAX_STATE_BUFFERS 8
+#define FRAME_UNIFORMS_BINDING 0
+
+// std140-image of the Frame-block in frameBlockSrc, GravityParams already
+// follows every vec3 with a float, so only the end needs padding
+struct FrameUniforms {
+    GLfloat mvp[16];
+    GravityParams gravity;
+    GLint numBodies;
+    GLfloat bodyMass;
+    GLfloat decimation;
+    GLfloat padding;
+};
+
+static_assert (sizeof (FrameUniforms) == 112,
+               "FrameUniforms doesn't match the std140-layout of Frame");
+
+// FloatLayout: position, velocity and distance as 7 floats (28 bytes)
+// PackedLayout: position as unsigned 16-bit normalized to uLimits, velocity as
+// half-floats and no distance (12 bytes), decoded by the vertex-fetch
+enum ParticleLayout {
+    FloatLayout,
+    PackedLayout
+};
+
+// what the gravity-pass does with particles leaving the simulation-volume,
+// the values are what its BOUNDS-define compares against
+enum BoundsMode {
+    WrapBounds,    // re-enter on the opposite side, slowed down
+    ReflectBounds, // bounce off the walls
+    NoBounds       // fly off, float-layout only
+};
 
 GLuint vbo = 0;
 GLuint tbo = 0;
+GLuint stateBuffers[MAX_STATE_BUFFERS] = {0};
+GLsync stateFences[MAX_STATE_BUFFERS] = {0};
+unsigned int numStateBuffers = DEFAULT_STATE_BUFFERS;
+unsigned int newestState = 0;
+unsigned int validStates = 0;
+size_t numParticles = DEFAULT_NUM_PARTICLES;
+ParticleLayout particleLayout = FloatLayout;
+GLuint particleSeed = 0;
+bool seedGiven = false;
+GLint uSeed = 0;
 GLint aVelocity = 0;
 GLint aTexCoord = 0;
-GLint uPersp = 0;
-GLint uAngles = 0;
-GLint uTranslate = 0;
-GLint uUseOpacity = 0;
-GLint uBlackHolePosition = 0;
-GLint uBlackHoleMass = 0;
-GLint uLimits = 0;
-GLint uTimeStep = 0;
 GLint uSampler = 0;
-GLint uEye = 0;
-GLint uAim = 0;
-GLint uUp = 0;
-GLint uPerspFeedback = 0;
-GLint uAnglesFeedback = 0;
-GLint uEyeFeedback = 0;
-GLint uAimFeedback = 0;
-GLint uUpFeedback = 0;
-GLint uTranslateFeedback = 0;
 GLint position = 0;
 GLint velocity = 0;
 GLfloat mouseX = WIN_WIDTH / 2;
 GLfloat mouseY = WIN_HEIGHT / 2;
-unsigned int lastFrameTick = 0;
+GLfloat timeStep = DEFAULT_TIME_STEP;
+unsigned int stepRate = DEFAULT_STEP_RATE;
+unsigned int maxSubSteps = DEFAULT_MAX_SUB_STEPS;
+unsigned int stepCount = 0;
+std::vector<GravitySource> gravitySources;
+bool movingGravitySources = false;
+GLuint sourceBuffer = 0;
+GLuint sourceTexture = 0;
+GLuint frameUniformBuffer = 0;
+size_t numBodies = 0;
+size_t activeBodies = 0;
+GLuint bodyTextures[MAX_STATE_BUFFERS] = {0};
+GLuint vertexArrays[MAX_STATE_BUFFERS] = {0};
+GLuint feedbackObjects[MAX_STATE_BUFFERS] = {0};
+GLuint lodVertexArrays[MAX_STATE_BUFFERS] = {0};
+unsigned int lodVertexArrayDecimations[MAX_STATE_BUFFERS] = {0};
+GLfloat lodDensity = 0.0f;
+unsigned int drawDecimation = 1;
+unsigned int maxDecimation = 1;
+GLfloat accumulationScale = 0.0f;
+GLuint accumulationFramebuffer = 0;
+GLuint accumulationTexture = 0;
+GLuint screenVertexArray = 0;
+int accumulationWidth = 0;
+int accumulationHeight = 0;
+double frameBudget = 0.0;
+QualityController* qualityController = nullptr;
+GpuTimer* stepTimer = nullptr;
+GpuTimer* drawTimer = nullptr;
+size_t activeParticles = 0;
 GLfloat blackHoleMass = 0.0;
 GLfloat eye[3] = {0.0, 0.0, 2.0};
 GLfloat aim[3] = {0.0, 0.0, 0.0};
@@ -86,365 +162,2331 @@ GLfloat up[3] = {0.0, 1.0, 0.0};
 GLfloat translate[3] = {0.0, 0.0, -25.0};
 GLfloat angles[3] = {0.0, 0.0, 0.0};
 GLint useOpacity = 0;
+bool useCpuBackend = false;
+unsigned int numThreads = 0;
+ThreadPool* threadPool = nullptr;
+bool useBarnesHut = false;
+BarnesHut* barnesHut = nullptr;
+GLfloat theta = 0.5f;
+GLfloat nbodyMass = BLACK_HOLE_MASS;
+ParticleArrays cpuParticles;
+unsigned int warmupSteps = 1;
+unsigned int repetitions = 1;
+bool jsonReport = false;
+const char* checkpointFile = nullptr;
+const char* restoreFile = nullptr;
+const char* recordFile = nullptr;
+unsigned int recordInterval = DEFAULT_RECORD_INTERVAL;
+bool recordDelta = false;
+TrajectoryRecorder* recorder = nullptr;
+const char* shaderCacheDir = DEFAULT_SHADER_CACHE_DIR;
+ProgramCache* programCache = nullptr;
+std::map<std::string, GLuint> programVariants;
+BoundsMode boundsMode = WrapBounds;
+unsigned int reorderInterval = 0;
+unsigned int stepsSinceReorder = 0;
+MortonOrder* mortonOrder = nullptr;
+bool reorderOwnsThreadPool = false;
+GLuint orderBuffer = 0;
+GLuint orderTexture = 0;
+GLuint reorderTexture = 0;
+
+// everything the programs need per frame in one uniform-block, uploaded once
+// per frame by updateFrameUniforms(), mirrored by struct FrameUniforms
+const GLchar* frameBlockSrc = GLSL_PART(
+    layout (std140) uniform Frame {
+        mat4 uMVP;                // perspective * view * model
+        vec3 uBlackHolePosition;  // already rotated into particle-space
+        float uBlackHoleMass;
+        vec3 uLimits;
+        float uTimeStep;
+        int uNumBodies;
+        float uBodyMass;
+        float uDecimation;        // only every uDecimation-th particle is drawn
+    };
+);
+
+// particle-drawing vertex- and fragment-shader
+const GLchar* vShaderSrc = GLSL140(
+    void loadParticle (out vec3 position, out vec3 velocity);
+
+    out float vOpacity;
+
+    void main()
+    {
+        vec3 position;
+        vec3 velocity;
+        loadParticle (position, velocity);
+
+        gl_Position = uMVP * vec4 (position, 1.0);
+        gl_PointSize = 0.5;
+
+        // k layers of alpha a cover as much as one of 1 - (1 - a)^k, so a
+        // decimated draw looks about the same as drawing all particles
+        float opacity = clamp (length (velocity), 0.0, 1.0);
+        vOpacity = 1.0 - pow (1.0 - opacity, uDecimation);
+    }
+);
+
+// USE_OPACITY is injected by particleProgram()
+const GLchar* fShaderSrc = GLSL(
+    in float vOpacity;
+    void main()
+    {
+        if (USE_OPACITY == 1) {
+            gl_FragColor = vec4 (.85, .85, .85, clamp (vOpacity, .0, 1.));
+        } else {
+            gl_FragColor = vec4 (.85, .85, .85, 1.);
+        }
+    }
+);
+
+// one triangle covering the whole viewport, no vertex-attributes needed
+const GLchar* screenVertexSrc = GLSL(
+    out vec2 vTexCoord;
+    void main()
+    {
+        vTexCoord = vec2 ((gl_VertexID << 1) & 2, gl_VertexID & 2);
+        gl_Position = vec4 (vTexCoord * 2. - 1., .0, 1.);
+    }
+);
+
+// the accumulation-buffer holds sum (color * alpha) and sum (alpha) of all
+// particles hitting a texel, n layers of alpha a leave (1 - a)^n ~ exp (-n * a)
+// of the background visible, which is what plain blending would have shown,
+// uCoverage spreads a texel's sum over the window-pixels it covers, a texel
+// whose sum overflowed anyway is fully covered, it mustn't divide inf by inf
+const GLchar* toneMapSrc = GLSL(
+    uniform sampler2D uAccumulation;
+    uniform vec3 uBackground;
+    uniform float uCoverage;
+    in vec2 vTexCoord;
+    void main()
+    {
+        vec4 sum = texture (uAccumulation, vTexCoord);
+        bool overflowed = isinf (sum.a) || isnan (sum.a);
+        vec3 color = overflowed ? vec3 (.85, .85, .85) :
+                     sum.a > .0 ? sum.rgb / sum.a : uBackground;
+        float alpha = overflowed ? 1. : 1. - exp (-sum.a * uCoverage);
+        gl_FragColor = vec4 (mix (uBackground, color, alpha), 1.);
+    }
+);
+
+// particle-gravity vertex-shader, BOUNDS and NUM_SOURCES are injected by
+// feedbackProgram(), so the compiler drops whatever they switch off
+const GLchar* particleGravitySrc = GLSL140(
+    void loadParticle (out vec3 position, out vec3 velocity);
+    void storeParticle (vec3 position, vec3 velocity, float distance);
+
+    const int WrapBounds = 0;
+    const int ReflectBounds = 1;
+
+    uniform samplerBuffer uSources;
+    uniform samplerBuffer uBodies;
+
+    vec3 fetchBody (int index);
+
+    // sum of all gravity-sources' pull as xyz = position, w = mass texels,
+    // fetched in tiles of four to get their loads in flight together, softened
+    // like the bodies (and Barnes-Hut's SOFTENING), so both pull alike
+    vec3 sourceAcceleration (vec3 position, float particleMass)
+    {
+        float g = 0.0000000000667384;
+        vec3 acceleration = vec3 (0.0);
+        for (int i = 0; i < NUM_SOURCES; i += 4) {
+            vec4 tile[4];
+            for (int j = 0; j < 4; ++j) {
+                tile[j] = texelFetch (uSources, min (i + j, NUM_SOURCES - 1));
+            }
+            for (int j = 0; j < 4 && i + j < NUM_SOURCES; ++j) {
+                vec3 p = tile[j].xyz - position;
+                float d = dot (p, p) + 0.0001;
+                acceleration += tile[j].w * p * inversesqrt (d) / d;
+            }
+        }
+        return g * particleMass * particleMass * acceleration;
+    }
+
+    // exact pull of the first uNumBodies particles as of the previous step,
+    // every particle walks them in the same order and four at a time, so the
+    // fetched texels are shared by all invocations running side by side
+    vec3 bodyAcceleration (vec3 position, float particleMass)
+    {
+        float g = 0.0000000000667384;
+        vec3 acceleration = vec3 (0.0);
+        for (int i = 0; i < uNumBodies; i += 4) {
+            vec3 tile[4];
+            for (int j = 0; j < 4; ++j) {
+                tile[j] = fetchBody (min (i + j, uNumBodies - 1));
+            }
+            for (int j = 0; j < 4 && i + j < uNumBodies; ++j) {
+                vec3 p = tile[j] - position;
+                float d = dot (p, p) + 0.0001;
+                acceleration += p * inversesqrt (d) / d;
+            }
+        }
+        return g * particleMass * particleMass * uBodyMass * acceleration;
+    }
+
+    void main() {
+        vec3 position;
+        vec3 velocity;
+        loadParticle (position, velocity);
+
+        vec3 blackHolePos = uBlackHolePosition;
+        vec3 p = blackHolePos - position;
+        float g = 0.0000000000667384;
+        float particleMass = 1000.0;
+        float k = g * particleMass * uBlackHoleMass;
+        float dist = length (p);
+        float d = dist * dist;
+
+        vec3 v = blackHolePos - position;
+        vec3 f = k * normalize (v) / d;
+
+        vec3 a = particleMass * f +
+                 sourceAcceleration (position, particleMass) +
+                 bodyAcceleration (position, particleMass);
+        vec3 newVelocity = a + velocity;
+        vec3 tmp = .475 * (velocity + newVelocity);
+        vec3 vPosition = position + tmp * uTimeStep;
+        vec3 vVelocity = tmp;
+        if (BOUNDS == ReflectBounds) {
+            bvec3 outside = notEqual (lessThanEqual (vPosition, -uLimits),
+                                      greaterThanEqual (vPosition, uLimits));
+            vPosition = clamp (vPosition, -uLimits, uLimits);
+            vVelocity = mix (tmp, -tmp, vec3 (outside));
+        } else if (BOUNDS == WrapBounds &&
+                   (any (lessThanEqual (vPosition, -uLimits)) ||
+                    any (greaterThanEqual (vPosition, uLimits)))) {
+            vVelocity = 0.1 * tmp;
+            if (vPosition.x <= -uLimits.x ) {
+                vPosition.x = uLimits.x;
+            } else if (vPosition.x >= uLimits.x) {
+                vPosition.x = -uLimits.x;
+            }
+            if (vPosition.y <= -uLimits.y) {
+                vPosition.y = uLimits.y;
+            } else if (vPosition.y >= uLimits.y) {
+                vPosition.y = -uLimits.y;
+            }
+            if (vPosition.z <= -uLimits.z) {
+                vPosition.z = uLimits.z;
+            } else if (vPosition.z >= uLimits.z) {
+                vPosition.z = -uLimits.z;
+            }
+        }
+        storeParticle (vPosition, vVelocity, dist);
+        gl_Position = vec4 (0.0, 0.0, 0.0, 0.0);
+    }
+);
+
+// initial state written straight into the particle-buffer via transform-
+// feedback, every random number is a hash of the particle's index and uSeed,
+// so no host-side copy is needed to seed or reset any number of particles
+const GLchar* seedSrc = GLSL140(
+    void storeParticle (vec3 position, vec3 velocity, float distance);
+
+    uniform uint uSeed;
+
+    // "lowbias32" integer-hash by Chris Wellons
+    uint hash (uint x)
+    {
+        x ^= x >> 16;
+        x *= 0x7feb352du;
+        x ^= x >> 15;
+        x *= 0x846ca68bu;
+        x ^= x >> 16;
+        return x;
+    }
+
+    // uniform in [0, 1), 24 bits are all a float holds exactly
+    float random (uint counter)
+    {
+        return float (hash (counter ^ hash (uSeed)) >> 8) / 16777216.0;
+    }
+
+    void main() {
+        uint counter = 3u * uint (gl_VertexID);
+        vec3 position = vec3 (random (counter),
+                              random (counter + 1u),
+                              random (counter + 2u));
+        storeParticle ((2.0 * position - 1.0) * uLimits, vec3 (0.0), 0.0);
+        gl_Position = vec4 (0.0, 0.0, 0.0, 0.0);
+    }
+);
+
+// the particle-layouts as seen by the shaders, appended to vShaderSrc,
+// particleGravitySrc and seedSrc they provide loadParticle() and
+// storeParticle()
+const GLchar* floatLayoutSrc = GLSL_PART(
+    in vec3 aPosition;
+    in vec3 aVelocity;
+    in float aDistance;
+
+    out vec3 vPosition;
+    out vec3 vVelocity;
+    out float vDistance;
+
+    void loadParticle (out vec3 position, out vec3 velocity)
+    {
+        position = aPosition;
+        velocity = aVelocity;
+    }
+
+    void storeParticle (vec3 position, vec3 velocity, float distance)
+    {
+        vPosition = position;
+        vVelocity = velocity;
+        vDistance = distance;
+    }
+);
+
+// transform-feedback only writes 32-bit components, so the shader packs two
+// 16-bit values per uint, vertex-fetch decodes them as GL_UNSIGNED_SHORT
+// normalized and GL_HALF_FLOAT when reading them back in
+const GLchar* packedLayoutSrc = GLSL_PART(
+    in vec3 aPosition;
+    in vec3 aVelocity;
+
+    flat out uvec3 vPacked;
+
+    void loadParticle (out vec3 position, out vec3 velocity)
+    {
+        position = (2.0 * aPosition - 1.0) * uLimits;
+        velocity = aVelocity;
+    }
+
+    uint toUnorm16 (float value, float limit)
+    {
+        float n = clamp (.5 * value / limit + .5, 0.0, 1.0);
+        return uint (round (n * 65535.0));
+    }
+
+    // no floatBitsToUint() in GLSL 1.30, so this goes the arithmetic way,
+    // clamped to the largest finite half instead of becoming infinite
+    uint toHalf (float value)
+    {
+        uint sign = value < 0.0 ? 0x8000u : 0u;
+        float a = min (abs (value), 65504.0);
+        if (a < 0.00006103515625) {
+            return sign | uint (round (a * 16777216.0));
+        }
+
+        float e = floor (log2 (a));
+        float m = a * exp2 (-e);
+        if (m >= 2.0) {
+            e += 1.0;
+            m *= 0.5;
+        } else if (m < 1.0) {
+            e -= 1.0;
+            m *= 2.0;
+        }
+        uint mantissa = uint (round ((m - 1.0) * 1024.0));
+        return sign | ((uint (e + 15.0) << 10) + mantissa);
+    }
+
+    void storeParticle (vec3 position, vec3 velocity, float distance)
+    {
+        uint x = toUnorm16 (position.x, uLimits.x);
+        uint y = toUnorm16 (position.y, uLimits.y);
+        uint z = toUnorm16 (position.z, uLimits.z);
+        vPacked = uvec3 (x | (y << 16),
+                         z | (toHalf (velocity.x) << 16),
+                         toHalf (velocity.y) | (toHalf (velocity.z) << 16));
+    }
+);
+
+// fetchBody() for the gravity-shader, reads a particle's position from the
+// buffer-texture over the previous step's particles
+const GLchar* floatBodiesSrc = GLSL_PART(
+    vec3 fetchBody (int index)
+    {
+        int texel = 7 * index;
+        return vec3 (texelFetch (uBodies, texel).r,
+                     texelFetch (uBodies, texel + 1).r,
+                     texelFetch (uBodies, texel + 2).r);
+    }
+);
+
+const GLchar* packedBodiesSrc = GLSL_PART(
+    vec3 fetchBody (int index)
+    {
+        int texel = 6 * index;
+        vec3 position = vec3 (texelFetch (uBodies, texel).r,
+                              texelFetch (uBodies, texel + 1).r,
+                              texelFetch (uBodies, texel + 2).r);
+        return (2.0 * position - 1.0) * uLimits;
+    }
+);
+
+// gather() for reorderSrc, copies particle index from the buffer-texture over
+// the particles to the varyings storeParticle() would write, bit for bit
+const GLchar* floatGatherSrc = GLSL_PART(
+    uniform samplerBuffer uParticles;
+
+    out vec3 vPosition;
+    out vec3 vVelocity;
+    out float vDistance;
+
+    void gather (int index)
+    {
+        int texel = 7 * index;
+        vPosition = vec3 (texelFetch (uParticles, texel).r,
+                          texelFetch (uParticles, texel + 1).r,
+                          texelFetch (uParticles, texel + 2).r);
+        vVelocity = vec3 (texelFetch (uParticles, texel + 3).r,
+                          texelFetch (uParticles, texel + 4).r,
+                          texelFetch (uParticles, texel + 5).r);
+        vDistance = texelFetch (uParticles, texel + 6).r;
+    }
+);
+
+const GLchar* packedGatherSrc = GLSL_PART(
+    uniform usamplerBuffer uParticles;
+
+    flat out uvec3 vPacked;
+
+    void gather (int index)
+    {
+        int texel = 3 * index;
+        vPacked = uvec3 (texelFetch (uParticles, texel).r,
+                         texelFetch (uParticles, texel + 1).r,
+                         texelFetch (uParticles, texel + 2).r);
+    }
+);
+
+// writes the particles in the order of the permutation in uOrder, run by
+// reorderParticles() via transform-feedback from the vbo into the tbo
+const GLchar* reorderSrc = GLSL140(
+    void gather (int index);
+
+    uniform usamplerBuffer uOrder;
+
+    void main() {
+        gather (int (texelFetch (uOrder, gl_VertexID).r));
+        gl_Position = vec4 (0.0, 0.0, 0.0, 0.0);
+    }
+);
+
+const char* layoutName ()
+{
+    return particleLayout == PackedLayout ? "packed" : "float";
+}
+
+const char* boundsName (BoundsMode mode)
+{
+    switch (mode) {
+        case ReflectBounds: return "reflect";
+        case NoBounds: return "none";
+        default: return "wrap";
+    }
+}
+
+// for cycling through them at runtime, the packed layout can't do without
+BoundsMode nextBoundsMode (BoundsMode mode)
+{
+    switch (mode) {
+        case WrapBounds: return ReflectBounds;
+        case ReflectBounds:
+            return particleLayout == PackedLayout ? WrapBounds : NoBounds;
+        default: return WrapBounds;
+    }
+}
+
+// the quality-controller may only simulate and draw the first ones
+size_t activeParticleCount ()
+{
+    if (activeParticles > 0 && activeParticles < numParticles) {
+        return activeParticles;
+    }
+
+    return numParticles;
+}
+
+size_t bytesPerParticle ()
+{
+    if (particleLayout == PackedLayout) {
+        return NUM_BYTES_PER_PACKED_VERTEX;
+    }
+
+    return NUM_FLOATS_PER_VERTEX * sizeof (GLfloat);
+}
+
+// the Frame-block goes right behind the #version-line, the layout's
+// loadParticle() and storeParticle() to the end, the block needs a line of
+// its own, as any #define shaderVariant() put there has to start a line
+std::string withLayout (const std::string& shaderSrc)
+{
+    std::string src (shaderSrc);
+    src.insert (src.find ('\n') + 1, std::string (frameBlockSrc) + "\n");
+    src += particleLayout == PackedLayout ? packedLayoutSrc : floatLayoutSrc;
+    return src;
+}
+
+// connects the program's Frame-block to the shared uniform-buffer
+void bindFrameBlock (GLuint program)
+{
+    GLuint index = glGetUniformBlockIndex (program, "Frame");
+    if (index != GL_INVALID_INDEX) {
+        glUniformBlockBinding (program, index, FRAME_UNIFORMS_BINDING);
+    }
+}
+
+void createFrameUniforms ()
+{
+    glGenBuffers (1, &frameUniformBuffer);
+    glBindBuffer (GL_UNIFORM_BUFFER, frameUniformBuffer);
+    glBufferData (GL_UNIFORM_BUFFER,
+                  sizeof (FrameUniforms),
+                  nullptr,
+                  GL_DYNAMIC_DRAW);
+    glBindBuffer (GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase (GL_UNIFORM_BUFFER,
+                      FRAME_UNIFORMS_BINDING,
+                      frameUniformBuffer);
+}
+
+void releaseFrameUniforms ()
+{
+    glDeleteBuffers (1, &frameUniformBuffer);
+    frameUniformBuffer = 0;
+}
+
+// binds buffer as the particle-source and describes its layout to the shaders,
+// with a decimation of k only every k-th particle is seen
+void bindParticleAttribs (GLuint buffer, unsigned int decimation)
+{
+    GLsizei stride = (GLsizei) (decimation * bytesPerParticle ());
+    GLchar* offset = 0;
+
+    glBindBuffer (GL_ARRAY_BUFFER, buffer);
+    glEnableVertexAttribArray (PositionAttr);
+    glEnableVertexAttribArray (VelocityAttr);
+
+    if (particleLayout == PackedLayout) {
+        glVertexAttribPointer (PositionAttr,
+                               3,
+                               GL_UNSIGNED_SHORT,
+                               GL_TRUE,
+                               stride,
+                               offset);
+        glVertexAttribPointer (VelocityAttr,
+                               3,
+                               GL_HALF_FLOAT,
+                               GL_FALSE,
+                               stride,
+                               3 * sizeof (GLushort) + offset);
+        return;
+    }
+
+    glEnableVertexAttribArray (DistanceAttr);
+    glVertexAttribPointer (PositionAttr,
+                           3,
+                           GL_FLOAT,
+                           GL_FALSE,
+                           stride,
+                           offset);
+    glVertexAttribPointer (VelocityAttr,
+                           3,
+                           GL_FLOAT,
+                           GL_FALSE,
+                           stride,
+                           3 * sizeof (GLfloat) + offset);
+    glVertexAttribPointer (DistanceAttr,
+                           1,
+                           GL_FLOAT,
+                           GL_FALSE,
+                           stride,
+                           6 * sizeof (GLfloat) + offset);
+}
+
+// transform-feedback objects remember how many particles were written last,
+// so drawing needs no count from the CPU (GL 4.0 or ARB_transform_feedback2)
+bool haveFeedbackObjects ()
+{
+    return GLEW_VERSION_4_0 || GLEW_ARB_transform_feedback2;
+}
+
+// one vertex-array and one transform-feedback object per state-buffer, set
+// up once so every pass only has to pick the ones for the buffers it reads
+// from and writes to, the --lod vertex-arrays get set up once they're used
+void createVertexArrays ()
+{
+    GLsizei count = (GLsizei) numStateBuffers;
+    glGenVertexArrays (count, vertexArrays);
+    glGenVertexArrays (count, lodVertexArrays);
+    if (haveFeedbackObjects ()) {
+        glGenTransformFeedbacks (count, feedbackObjects);
+    }
+    for (unsigned int i = 0; i < numStateBuffers; ++i) {
+        glBindVertexArray (vertexArrays[i]);
+        bindParticleAttribs (stateBuffers[i], 1);
+        if (feedbackObjects[i]) {
+            glBindTransformFeedback (GL_TRANSFORM_FEEDBACK,
+                                     feedbackObjects[i]);
+            glBindBufferBase (GL_TRANSFORM_FEEDBACK_BUFFER,
+                              0,
+                              stateBuffers[i]);
+        }
+    }
+    glBindTransformFeedback (GL_TRANSFORM_FEEDBACK, 0);
+    glBindVertexArray (0);
+    glBindBuffer (GL_ARRAY_BUFFER, 0);
+}
+
+void releaseVertexArrays ()
+{
+    GLsizei count = (GLsizei) numStateBuffers;
+    glDeleteVertexArrays (count, vertexArrays);
+    glDeleteVertexArrays (count, lodVertexArrays);
+    if (feedbackObjects[0]) {
+        glDeleteTransformFeedbacks (count, feedbackObjects);
+    }
+    for (unsigned int i = 0; i < numStateBuffers; ++i) {
+        vertexArrays[i] = 0;
+        lodVertexArrays[i] = 0;
+        lodVertexArrayDecimations[i] = 0;
+        feedbackObjects[i] = 0;
+    }
+}
+
+// the slot of buffer in the ring of state-buffers
+unsigned int stateIndex (GLuint buffer)
+{
+    for (unsigned int i = 0; i < numStateBuffers; ++i) {
+        if (stateBuffers[i] == buffer) {
+            return i;
+        }
+    }
+
+    return 0;
+}
+
+// The particles' states live in a ring of numStateBuffers buffers, the vbo
+// holds the newest one and the tbo, the oldest, is what the next pass
+// overwrites. Every new state gets a fence, so drawGL() can tell whether the
+// GPU is done with it, and draw the one before instead if it isn't. With
+// three or more buffers that one isn't the next pass' target, so drawing it
+// and simulating the next step don't depend on each other.
+void selectStates ()
+{
+    vbo = stateBuffers[newestState];
+    tbo = stateBuffers[(newestState + 1) % numStateBuffers];
+}
+
+void fenceNewestState ()
+{
+    GLsync& fence = stateFences[newestState];
+    if (fence) {
+        glDeleteSync (fence);
+    }
+    fence = glFenceSync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+// call after a pass wrote the tbo, it becomes the newest state
+void advanceState ()
+{
+    newestState = (newestState + 1) % numStateBuffers;
+    validStates = std::min (validStates + 1, numStateBuffers);
+    fenceNewestState ();
+    selectStates ();
+}
+
+// call after the vbo got overwritten in place, the older states don't lead
+// up to it anymore and mustn't be drawn
+void restartStates ()
+{
+    validStates = 1;
+    fenceNewestState ();
+}
+
+// doesn't wait, but flushes, so the fence gets signaled eventually
+bool stateDone (unsigned int index)
+{
+    GLsync fence = stateFences[index];
+    return !fence ||
+           glClientWaitSync (fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) !=
+               GL_TIMEOUT_EXPIRED;
+}
+
+// the newest state the GPU already finished, or the one before
+GLuint drawState ()
+{
+    if (numStateBuffers < 3 || validStates < 2 || stateDone (newestState)) {
+        return vbo;
+    }
+
+    return stateBuffers[(newestState + numStateBuffers - 1) %
+                        numStateBuffers];
+}
+
+// blocks until the newest state is done, before the CPU reads it back
+void waitForNewestState ()
+{
+    TraceScope trace ("waitForNewestState");
+    GLsync fence = stateFences[newestState];
+    if (!fence) {
+        return;
+    }
+
+    while (glClientWaitSync (fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) ==
+           GL_TIMEOUT_EXPIRED) {
+    }
+}
+
+// the largest decimation a vertex-attribute's stride can express, before
+// GL 4.4 there's no query, but 2048 is what drivers generally support, it
+// only changes with the layout, so it's queried once the buffers are created
+void updateMaxDecimation ()
+{
+    GLint maxStride = 2048;
+    if (GLEW_VERSION_4_4) {
+        glGetIntegerv (GL_MAX_VERTEX_ATTRIB_STRIDE, &maxStride);
+    }
+
+    size_t decimation = (size_t) maxStride / bytesPerParticle ();
+    maxDecimation = (unsigned int) std::max (decimation, (size_t) 1);
+}
+
+// with --lod at most lodDensity particles per window-pixel get drawn, beyond
+// that they'd mostly overdraw each other anyway
+void updateDecimation (int width, int height)
+{
+    if (lodDensity <= 0.0f) {
+        drawDecimation = 1;
+        return;
+    }
+
+    double budget = std::max ((double) lodDensity * width * height, 1.0);
+    double decimation = std::ceil ((double) activeParticleCount () / budget);
+    drawDecimation = (unsigned int) std::min (decimation,
+                                              (double) maxDecimation);
+}
+
+// the vertex-array seeing every drawDecimation-th particle of buffer, each
+// state-buffer has its own, only re-specified when the decimation changes
+GLuint lodVertexArrayFor (GLuint buffer)
+{
+    unsigned int index = stateIndex (buffer);
+    GLuint vertexArray = lodVertexArrays[index];
+    if (lodVertexArrayDecimations[index] != drawDecimation) {
+        glBindVertexArray (vertexArray);
+        bindParticleAttribs (buffer, drawDecimation);
+        glBindBuffer (GL_ARRAY_BUFFER, 0);
+        glBindVertexArray (0);
+        lodVertexArrayDecimations[index] = drawDecimation;
+    }
+
+    return vertexArray;
+}
+
+// makes buffer the target of the next transform-feedback pass
+void bindFeedbackTarget (GLuint buffer)
+{
+    GLuint object = feedbackObjects[stateIndex (buffer)];
+    if (object) {
+        glBindTransformFeedback (GL_TRANSFORM_FEEDBACK, object);
+    } else {
+        glBindBufferBase (GL_TRANSFORM_FEEDBACK_BUFFER, 0, buffer);
+    }
+}
+
+void unbindFeedbackTarget ()
+{
+    if (feedbackObjects[0]) {
+        glBindTransformFeedback (GL_TRANSFORM_FEEDBACK, 0);
+    } else {
+        glBindBufferBase (GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    }
+}
+
+GLsizeiptr particleBufferSize (size_t count)
+{
+    return (GLsizeiptr) (count * bytesPerParticle ());
+}
+
+// hands the current source-positions and -masses to the gravity-shader
+void uploadGravitySources ()
+{
+    std::vector<GLfloat> texels;
+    texels.reserve (4 * gravitySources.size ());
+    for (const GravitySource& source : gravitySources) {
+        texels.insert (texels.end (), source.position, source.position + 3);
+        texels.push_back (source.mass);
+    }
+
+    glBindBuffer (GL_TEXTURE_BUFFER, sourceBuffer);
+    glBufferData (GL_TEXTURE_BUFFER,
+                  texels.size () * sizeof (GLfloat),
+                  texels.data (),
+                  GL_STREAM_DRAW);
+    glBindBuffer (GL_TEXTURE_BUFFER, 0);
+}
+
+void createGravitySources ()
+{
+    movingGravitySources = hasMovingGravitySources (gravitySources);
+    if (gravitySources.empty ()) {
+        return;
+    }
+
+    GLint maxTexels = 0;
+    glGetIntegerv (GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+    if (gravitySources.size () > (size_t) maxTexels) {
+        std::cout << "Only using " << maxTexels << " of "
+                  << gravitySources.size () << " gravity-sources" << std::endl;
+        gravitySources.resize (maxTexels);
+    }
+
+    glGenBuffers (1, &sourceBuffer);
+    uploadGravitySources ();
+    glGenTextures (1, &sourceTexture);
+    glBindTexture (GL_TEXTURE_BUFFER, sourceTexture);
+    glTexBuffer (GL_TEXTURE_BUFFER, GL_RGBA32F, sourceBuffer);
+    glBindTexture (GL_TEXTURE_BUFFER, 0);
+}
+
+void releaseGravitySources ()
+{
+    glDeleteTextures (1, &sourceTexture);
+    glDeleteBuffers (1, &sourceBuffer);
+    sourceTexture = 0;
+    sourceBuffer = 0;
+}
+
+// buffer-textures over both ping-pong buffers, so the gravity-pass can fetch
+// the massive bodies from the buffer it reads the particles from
+void createBodyTextures ()
+{
+    activeBodies = numBodies < numParticles ? numBodies : numParticles;
+    if (activeBodies == 0) {
+        return;
+    }
+
+    GLint maxTexels = 0;
+    glGetIntegerv (GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+    size_t texelsPerParticle = particleLayout == PackedLayout ? 6 : 7;
+    if (activeBodies > maxTexels / texelsPerParticle) {
+        activeBodies = maxTexels / texelsPerParticle;
+        std::cout << "Only using " << activeBodies << " massive bodies"
+                  << std::endl;
+    }
+
+    GLenum format = particleLayout == PackedLayout ? GL_R16 : GL_R32F;
+    glGenTextures ((GLsizei) numStateBuffers, bodyTextures);
+    for (unsigned int i = 0; i < numStateBuffers; ++i) {
+        glBindTexture (GL_TEXTURE_BUFFER, bodyTextures[i]);
+        glTexBuffer (GL_TEXTURE_BUFFER, format, stateBuffers[i]);
+    }
+    glBindTexture (GL_TEXTURE_BUFFER, 0);
+}
+
+void releaseBodyTextures ()
+{
+    glDeleteTextures ((GLsizei) numStateBuffers, bodyTextures);
+    for (unsigned int i = 0; i < numStateBuffers; ++i) {
+        bodyTextures[i] = 0;
+    }
+    activeBodies = 0;
+}
+
+GLuint bodyTexture (GLuint buffer)
+{
+    return bodyTextures[stateIndex (buffer)];
+}
+
+// the per-pass constants of the gravity-pass for both backends, the rotation
+// of the black-hole is done here once instead of per particle
+void gravityParams (int width, int height, GravityParams* params)
+{
+    float blackHolePos[3] = {30.0f * (mouseX / width) - 15.0f,
+                             30.0f * (mouseY / height) - 15.0f,
+                             .0f};
+    float rot[16];
+    rotate (angles[0], angles[1], angles[2], rot);
+    for (int i = 0; i < 3; ++i) {
+        params->blackHolePosition[i] = rot[i] * blackHolePos[0] +
+                                       rot[4 + i] * blackHolePos[1] +
+                                       rot[8 + i] * blackHolePos[2] +
+                                       rot[12 + i];
+        params->limits[i] = 15.0f;
+    }
+    params->blackHoleMass = blackHoleMass;
+    params->timeStep = timeStep;
+}
+
+// one upload per frame for all programs and gravity-passes, persp is nullptr
+// when nothing gets drawn
+void updateFrameUniforms (int width, int height, const float* persp)
+{
+    FrameUniforms frame;
+    std::memset (&frame, 0, sizeof (frame));
+    if (persp) {
+        float view[16];
+        float model[16];
+        float rot[16];
+        float trans[16];
+        float viewProj[16];
+        lookAt (eye, aim, up, view);
+        rotate (angles[0], angles[1], angles[2], rot);
+        translation (translate[0], translate[1], translate[2], trans);
+        multiply (trans, rot, model);
+        multiply (persp, view, viewProj);
+        multiply (viewProj, model, frame.mvp);
+    }
+    gravityParams (width, height, &frame.gravity);
+    frame.numBodies = (GLint) activeBodies;
+    frame.bodyMass = activeBodies ? nbodyMass / activeBodies : 0.0f;
+    frame.decimation = (GLfloat) drawDecimation;
+
+    glBindBuffer (GL_UNIFORM_BUFFER, frameUniformBuffer);
+    glBufferSubData (GL_UNIFORM_BUFFER, 0, sizeof (frame), &frame);
+    glBindBuffer (GL_UNIFORM_BUFFER, 0);
+}
+
+// all other uniforms of the pass come from the Frame-block
+void updateFeedbackBuffer (GLuint program)
+{
+    TraceScope trace ("updateFeedbackBuffer");
+    GpuTraceScope gpuTrace ("updateFeedbackBuffer");
+
+    if (movingGravitySources) {
+        const float limits[3] = {15.0f, 15.0f, 15.0f};
+        moveGravitySources (gravitySources, timeStep, limits);
+        uploadGravitySources ();
+    }
+
+    glUseProgram (program);
+    glBindTexture (GL_TEXTURE_BUFFER, sourceTexture);
+    glActiveTexture (GL_TEXTURE1);
+    glBindTexture (GL_TEXTURE_BUFFER, bodyTexture (vbo));
+    glActiveTexture (GL_TEXTURE0);
+
+    glEnable (GL_RASTERIZER_DISCARD);
+    glBindVertexArray (vertexArrays[stateIndex (vbo)]);
+    bindFeedbackTarget (tbo);
+    glBeginTransformFeedback (GL_POINTS);
+    glDrawArrays (GL_POINTS, 0, (GLsizei) activeParticleCount ());
+    glEndTransformFeedback ();
+    unbindFeedbackTarget ();
+    glBindVertexArray (0);
+    glDisable (GL_RASTERIZER_DISCARD);
+    glBindTexture (GL_TEXTURE_BUFFER, 0);
+    glActiveTexture (GL_TEXTURE1);
+    glBindTexture (GL_TEXTURE_BUFFER, 0);
+    glActiveTexture (GL_TEXTURE0);
+
+    // the fence replaces a glFlush (), drawState () flushes when checking it
+    advanceState ();
+}
+
+// the CPU-backend either only feels the black-hole or all other particles too
+void createCpuBackend ()
+{
+    threadPool = new ThreadPool (numThreads);
+    std::cout << "simulating on " << threadPool->size () << " threads using ";
+    if (useBarnesHut) {
+        barnesHut = new BarnesHut (theta);
+        std::cout << "Barnes-Hut with theta " << theta << std::endl;
+    } else {
+        std::cout << gravityKernelName () << "-kernel" << std::endl;
+    }
+}
+
+void releaseCpuBackend ()
+{
+    delete barnesHut;
+    delete threadPool;
+    barnesHut = nullptr;
+    threadPool = nullptr;
+}
+
+void stepCpuBackend (const GravityParams& params)
+{
+    TraceScope trace (barnesHut ? "BarnesHut::step" : "stepGravity");
+
+    if (barnesHut) {
+        // nbodyMass is shared by all particles, so the total pull stays the
+        // same for any number of them
+        barnesHut->step (*threadPool,
+                         cpuParticles,
+                         params,
+                         nbodyMass / numParticles);
+    } else {
+        stepGravity (*threadPool, cpuParticles, params);
+    }
+}
+
+// interleave straight into the tbo, saves a second host-side copy, and as the
+// oldest state it's the one least likely to still be drawn from
+void uploadCpuParticles ()
+{
+    GpuTraceScope gpuTrace ("uploadParticles");
+    glBindBuffer (GL_ARRAY_BUFFER, tbo);
+    GLfloat* mapped = (GLfloat*) glMapBufferRange (GL_ARRAY_BUFFER,
+                                                   0,
+                                                   particleBufferSize (
+                                                       numParticles),
+                                                   GL_MAP_WRITE_BIT |
+                                                   GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (mapped) {
+        fromParticleArrays (*threadPool, cpuParticles, mapped);
+        glUnmapBuffer (GL_ARRAY_BUFFER);
+    }
+    glBindBuffer (GL_ARRAY_BUFFER, 0);
+    advanceState ();
+}
+
+void updateCpuSimulation (int width, int height, unsigned int steps)
+{
+    TraceScope trace ("updateCpuSimulation");
+    GravityParams params;
+    gravityParams (width, height, &params);
+    for (unsigned int step = 0; step < steps; ++step) {
+        stepCpuBackend (params);
+    }
+
+    uploadCpuParticles ();
+}
+
+void releaseAccumulation ()
+{
+    glDeleteFramebuffers (1, &accumulationFramebuffer);
+    glDeleteTextures (1, &accumulationTexture);
+    glDeleteVertexArrays (1, &screenVertexArray);
+    accumulationFramebuffer = 0;
+    accumulationTexture = 0;
+    screenVertexArray = 0;
+}
+
+// with --accumulate the particles get splatted additively into a float-
+// texture of accumulationScale times the window's size, much cheaper to blend
+// into than the multisampled window, drawGL() then tone-maps it to the window,
+// 32-bit floats as a dense core's sums would exceed a half-float's 65504
+void createAccumulation (int width, int height)
+{
+    releaseAccumulation ();
+    if (accumulationScale <= 0.0f) {
+        return;
+    }
+
+    accumulationWidth = std::max ((int) (width * accumulationScale), 1);
+    accumulationHeight = std::max ((int) (height * accumulationScale), 1);
+
+    glGenTextures (1, &accumulationTexture);
+    glBindTexture (GL_TEXTURE_2D, accumulationTexture);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D (GL_TEXTURE_2D,
+                  0,
+                  GL_RGBA32F,
+                  accumulationWidth,
+                  accumulationHeight,
+                  0,
+                  GL_RGBA,
+                  GL_FLOAT,
+                  nullptr);
+    glBindTexture (GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers (1, &accumulationFramebuffer);
+    glBindFramebuffer (GL_FRAMEBUFFER, accumulationFramebuffer);
+    glFramebufferTexture2D (GL_FRAMEBUFFER,
+                            GL_COLOR_ATTACHMENT0,
+                            GL_TEXTURE_2D,
+                            accumulationTexture,
+                            0);
+    GLenum status = glCheckFramebufferStatus (GL_FRAMEBUFFER);
+    glBindFramebuffer (GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        std::cout << "Can't render to a float-texture, drawing particles "
+                  << "directly" << std::endl;
+        releaseAccumulation ();
+        accumulationScale = 0.0f;
+        return;
+    }
+
+    glGenVertexArrays (1, &screenVertexArray);
+}
+
+void initGL (SDL_Window* window, int width, int height, float* persp)
+{
+    if (!window) {
+        return;
+    }
+
+    dumpGLInfo (); // dumps to stdout when compiled without -mwindows under Win
+
+    glClearColor (BG_COLOR, 1.0);
+    //glViewport (0, 0, width, height);
+    //ortho (0.0, width, height, 0.0, Z_NEAR, Z_FAR, persp);
+
+    // setup proper GL-blending
+    glEnable (GL_BLEND);
+    glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glBlendEquation (GL_FUNC_ADD);
+    glEnable (GL_PROGRAM_POINT_SIZE);
+
+    createAccumulation (width, height);
+    perspective (FOV, (GLfloat) width / (GLfloat) height, Z_NEAR, Z_FAR, persp);
+}
+
+void resizeGL (SDL_Window* window, int width, int height, float* persp)
+{
+    if (!window) {
+        return;
+    }
+
+    glViewport (0, 0, width, height);
+    createAccumulation (width, height);
+
+    //ortho (0.0, width, height, 0.0, Z_NEAR, Z_FAR, persp);
+    perspective (FOV, (GLfloat) width / (GLfloat) height, Z_NEAR, Z_FAR, persp);
+}
+
+// what storeParticle() writes for the current layout, before linking
+void setFeedbackVaryings (GLuint program)
+{
+    const GLchar* floatVaryings[] = {"vPosition", "vVelocity", "vDistance"};
+    const GLchar* packedVaryings[] = {"vPacked"};
+    if (particleLayout == PackedLayout) {
+        glTransformFeedbackVaryings (program,
+                                     1,
+                                     packedVaryings,
+                                     GL_INTERLEAVED_ATTRIBS);
+    } else {
+        glTransformFeedbackVaryings (program,
+                                     3,
+                                     floatVaryings,
+                                     GL_INTERLEAVED_ATTRIBS);
+    }
+}
+
+void createProgramCache ()
+{
+    if (shaderCacheDir) {
+        programCache = new ProgramCache (shaderCacheDir);
+    }
+}
+
+// deletes every variant built so far, the next use builds them anew
+void releasePrograms ()
+{
+    for (const auto& variant : programVariants) {
+        glDeleteProgram (variant.second);
+    }
+    programVariants.clear ();
+    delete programCache;
+    programCache = nullptr;
+}
+
+// links a program from source unless the shader-cache still has its binary,
+// vertex-only ones are transform-feedback passes writing storeParticle()'s
+// varyings, all of them share the vertex-arrays and thus attribute-locations
+GLuint buildProgram (const std::string& vertexSrc,
+                     const std::string& fragmentSrc)
+{
+    std::string source (vertexSrc);
+    source += '\0';
+    source += fragmentSrc;
+    GLuint program = programCache ? programCache->load (source) : 0;
+    if (!program) {
+        program = createShaderProgram (vertexSrc.c_str (),
+                                       fragmentSrc.empty () ?
+                                           NULL : fragmentSrc.c_str (),
+                                       false);
+        glBindAttribLocation (program, PositionAttr, "aPosition");
+        glBindAttribLocation (program, VelocityAttr, "aVelocity");
+        glBindAttribLocation (program, DistanceAttr, "aDistance");
+        if (fragmentSrc.empty ()) {
+            setFeedbackVaryings (program);
+        }
+        if (programCache) {
+            programCache->prepare (program);
+        }
+        linkShaderProgram (program);
+        if (programCache) {
+            programCache->store (source, program);
+        }
+    }
+
+    // neither is part of a program-binary, only the texture-units of the
+    // gravity-pass and the Frame-block need to be set up
+    bindFrameBlock (program);
+    glUseProgram (program);
+    glUniform1i (glGetUniformLocation (program, "uSources"), 0);
+    glUniform1i (glGetUniformLocation (program, "uBodies"), 1);
+
+    return program;
+}
+
+// the key of a variant in programVariants, e.g. "gravity/float BOUNDS=0"
+std::string variantName (const char* name, const ShaderDefines& defines)
+{
+    std::string variant (name);
+    variant += "/";
+    variant += layoutName ();
+    for (const auto& define : defines) {
+        variant += " " + define.first + "=" + std::to_string (define.second);
+    }
+
+    return variant;
+}
+
+// the gravity-pass specialized for the boundary-mode and number of gravity-
+// sources, built on first use like all variants
+GLuint feedbackProgram ()
+{
+    ShaderDefines defines;
+    defines.push_back (std::make_pair ("BOUNDS", (int) boundsMode));
+    defines.push_back (std::make_pair ("NUM_SOURCES",
+                                       (int) gravitySources.size ()));
+    GLuint& program = programVariants[variantName ("gravity", defines)];
+    if (!program) {
+        std::string src = withLayout (shaderVariant (particleGravitySrc,
+                                                     defines));
+        src += particleLayout == PackedLayout ? packedBodiesSrc
+                                              : floatBodiesSrc;
+        program = buildProgram (src, std::string ());
+    }
+
+    return program;
+}
+
+GLuint seedProgram ()
+{
+    GLuint& program = programVariants[variantName ("seed", ShaderDefines ())];
+    if (!program) {
+        program = buildProgram (withLayout (seedSrc), std::string ());
+        uSeed = glGetUniformLocation (program, "uSeed");
+    }
+
+    return program;
+}
+
+GLuint particleProgram ()
+{
+    ShaderDefines defines;
+    defines.push_back (std::make_pair ("USE_OPACITY", useOpacity ? 1 : 0));
+    GLuint& program = programVariants[variantName ("draw", defines)];
+    if (!program) {
+        program = buildProgram (withLayout (vShaderSrc),
+                                shaderVariant (fShaderSrc, defines));
+    }
+
+    return program;
+}
+
+GLuint toneMapProgram ()
+{
+    GLuint& program = programVariants[variantName ("tone-map",
+                                                   ShaderDefines ())];
+    if (!program) {
+        program = buildProgram (screenVertexSrc, toneMapSrc);
+        glUniform1i (glGetUniformLocation (program, "uAccumulation"), 0);
+        glUniform3f (glGetUniformLocation (program, "uBackground"), BG_COLOR);
+        glUniform1f (glGetUniformLocation (program, "uCoverage"),
+                     accumulationScale * accumulationScale);
+    }
+
+    return program;
+}
+
+GLuint reorderProgram ()
+{
+    GLuint& program = programVariants[variantName ("reorder",
+                                                   ShaderDefines ())];
+    if (!program) {
+        std::string src (reorderSrc);
+        src += particleLayout == PackedLayout ? packedGatherSrc
+                                              : floatGatherSrc;
+        program = buildProgram (src, std::string ());
+        glUniform1i (glGetUniformLocation (program, "uParticles"), 0);
+        glUniform1i (glGetUniformLocation (program, "uOrder"), 1);
+    }
+
+    return program;
+}
+
+// the controller only ever drops the particles at the end of the buffers,
+// with --reorder those are a region of space, not a random sample, and the
+// CPU-backend always steps all of them, the dropped ones go stale, so neither
+// --record nor the --bodies' pull may see them either, call whenever the
+// buffers get created or reordering stops
+void updateQualityLimits ()
+{
+    if (!qualityController) {
+        return;
+    }
+
+    QualitySettings most = {maxSubSteps, numParticles, 1};
+    QualitySettings least = {1, numParticles, maxDecimation};
+    if (!useCpuBackend && !mortonOrder && !recorder && activeBodies == 0) {
+        least.particles = std::max (numParticles / 64, (size_t) 1);
+    }
+    qualityController->setLimits (most, least);
+}
+
+// with --frame-budget the quality-controller gets the steps' and drawing's
+// GPU-time from timer-queries, or just the CPU's time submitting them without
+void createQualityController ()
+{
+    if (frameBudget <= 0.0) {
+        return;
+    }
+
+    qualityController = new QualityController (frameBudget);
+    if (GpuTimer::available ()) {
+        drawTimer = new GpuTimer ();
+        if (!useCpuBackend) {
+            stepTimer = new GpuTimer ();
+        }
+    } else {
+        std::cout << "No timer-queries, the quality-controller only sees the "
+                  << "CPU's time" << std::endl;
+    }
+    updateQualityLimits ();
+}
+
+void releaseQualityController ()
+{
+    delete qualityController;
+    delete stepTimer;
+    delete drawTimer;
+    qualityController = nullptr;
+    stepTimer = nullptr;
+    drawTimer = nullptr;
+    activeParticles = 0;
+}
+
+// the particles the controller stops simulating keep the state they have in
+// the newest buffer, copied over the older steps' states the other buffers of
+// the ring hold, else they'd jump between those once simulated again
+void freezeParticles (size_t begin, size_t end)
+{
+    if (useCpuBackend || begin >= end) {
+        return;
+    }
+
+    GLintptr offset = (GLintptr) (begin * bytesPerParticle ());
+    GLsizeiptr size = (GLsizeiptr) ((end - begin) * bytesPerParticle ());
+    glBindBuffer (GL_COPY_READ_BUFFER, vbo);
+    for (unsigned int i = 0; i < numStateBuffers; ++i) {
+        if (stateBuffers[i] != vbo) {
+            glBindBuffer (GL_COPY_WRITE_BUFFER, stateBuffers[i]);
+            glCopyBufferSubData (GL_COPY_READ_BUFFER,
+                                 GL_COPY_WRITE_BUFFER,
+                                 offset,
+                                 offset,
+                                 size);
+        }
+    }
+    glBindBuffer (GL_COPY_WRITE_BUFFER, 0);
+    glBindBuffer (GL_COPY_READ_BUFFER, 0);
+}
+
+double millisecondsSince (std::chrono::steady_clock::time_point start)
+{
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now () - start;
+    return elapsed.count ();
+}
+
+// hands the controller the timer-queries finished by now
+void pollQualityTimers ()
+{
+    double milliseconds = 0.0;
+    unsigned int steps = 0;
+    while (stepTimer && stepTimer->poll (&milliseconds, &steps)) {
+        qualityController->addSteps (milliseconds, steps);
+    }
+    while (drawTimer && drawTimer->poll (&milliseconds)) {
+        qualityController->addDraw (milliseconds);
+    }
+}
+
+// issues the draw-call for the particles in bufferId, honoring --lod
+void drawParticles (GLuint bufferId)
+{
+    // the CPU-backend fills the buffer by mapping it, so only the
+    // GPU-backend's feedback-objects know the count
+    GLuint object = feedbackObjects[stateIndex (bufferId)];
+    size_t count = activeParticleCount ();
+    if (drawDecimation > 1) {
+        glBindVertexArray (lodVertexArrayFor (bufferId));
+        glDrawArrays (GL_POINTS,
+                      0,
+                      (GLsizei) ((count + drawDecimation - 1) /
+                                 drawDecimation));
+    } else if (object && !useCpuBackend) {
+        glBindVertexArray (vertexArrays[stateIndex (bufferId)]);
+        glDrawTransformFeedback (GL_POINTS, object);
+    } else {
+        glBindVertexArray (vertexArrays[stateIndex (bufferId)]);
+        glDrawArrays (GL_POINTS, 0, (GLsizei) count);
+    }
+    glBindVertexArray (0);
+}
+
+void drawGL (SDL_Window* window, GLuint program, GLuint bufferId)
+{
+    // vbo, uniform, attrib
+    static unsigned int fps = 0;
+    static unsigned int lastSteps = 0;
+    static unsigned int lastTick = 0;
+    static unsigned int currentTick = 0;
+
+    if (!window) {
+        return;
+    }
+
+    TraceScope trace ("drawGL");
+    auto drawStart = std::chrono::steady_clock::now ();
+    if (drawTimer) {
+        drawTimer->begin ();
+    }
+    if (accumulationFramebuffer) {
+        GpuTraceScope gpuTrace ("drawGL");
+        {
+            GpuTraceScope splatTrace ("splatParticles");
+            glBindFramebuffer (GL_FRAMEBUFFER, accumulationFramebuffer);
+            glViewport (0, 0, accumulationWidth, accumulationHeight);
+            glClearColor (0.0, 0.0, 0.0, 0.0);
+            glClear (GL_COLOR_BUFFER_BIT);
+            glBlendFuncSeparate (GL_SRC_ALPHA, GL_ONE, GL_ONE, GL_ONE);
+            glUseProgram (program);
+            drawParticles (bufferId);
+        }
+
+        {
+            GpuTraceScope toneMapTrace ("toneMap");
+            int width = 0;
+            int height = 0;
+            SDL_GetWindowSize (window, &width, &height);
+            glBindFramebuffer (GL_FRAMEBUFFER, 0);
+            glViewport (0, 0, width, height);
+            glDisable (GL_BLEND);
+            glUseProgram (toneMapProgram ());
+            glActiveTexture (GL_TEXTURE0);
+            glBindTexture (GL_TEXTURE_2D, accumulationTexture);
+            glBindVertexArray (screenVertexArray);
+            glDrawArrays (GL_TRIANGLES, 0, 3);
+            glBindVertexArray (0);
+            glBindTexture (GL_TEXTURE_2D, 0);
+        }
+
+        glEnable (GL_BLEND);
+        glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glClearColor (BG_COLOR, 1.0);
+    } else {
+        GpuTraceScope gpuTrace ("drawGL");
+        glClear (GL_COLOR_BUFFER_BIT);
+        glUseProgram (program);
+        drawParticles (bufferId);
+        glBindTexture (GL_TEXTURE_2D, 0);
+    }
+    if (drawTimer) {
+        drawTimer->end ();
+    } else if (qualityController) {
+        qualityController->addDraw (millisecondsSince (drawStart));
+    }
+
+    // only now, the Frame-block of this frame was built with the old angles
+    // for the gravity-passes and the drawing alike
+    angles[0] += .3;
+    angles[1] += .2;
+    //angles[2] -= .35;
+
+    {
+        TraceScope swapTrace ("SDL_GL_SwapWindow");
+        SDL_GL_SwapWindow (window);
+    }
+
+    fps++;
+    currentTick = SDL_GetTicks ();
+
+    if (currentTick - lastTick > 1000)
+    {
+        std::stringstream title;
+        title << WIN_TITLE << " - " << fps << " fps, "
+              << stepCount - lastSteps << " steps/sec";
+        if (drawDecimation > 1) {
+            title << ", drawing 1/" << drawDecimation;
+        }
+        std::string str (title.str ());
+        SDL_SetWindowTitle (window, str.c_str ());
+        fps = 0;
+        lastSteps = stepCount;
+        lastTick = currentTick;
+    }
+}
+
+// (re)seeds the particles in the vbo in a single transform-feedback pass,
+// the CPU-backend seeds its own arrays with the same hash in parallel
+void seedParticles ()
+{
+    if (useCpuBackend) {
+        seedParticleArrays (*threadPool, &cpuParticles, particleSeed, 15.0f);
+        uploadCpuParticles ();
+        restartStates ();
+        return;
+    }
+
+    glUseProgram (seedProgram ());
+    glUniform1ui (uSeed, particleSeed);
+    glEnable (GL_RASTERIZER_DISCARD);
+    bindFeedbackTarget (vbo);
+    glBeginTransformFeedback (GL_POINTS);
+    glDrawArrays (GL_POINTS, 0, (GLsizei) numParticles);
+    glEndTransformFeedback ();
+    unbindFeedbackTarget ();
+    glDisable (GL_RASTERIZER_DISCARD);
+    restartStates ();
+}
+
+void createReorder ()
+{
+    if (reorderInterval == 0) {
+        return;
+    }
+
+    // the GPU-backend sorts on the CPU as well
+    if (!threadPool) {
+        threadPool = new ThreadPool (numThreads);
+        reorderOwnsThreadPool = true;
+    }
+    mortonOrder = new MortonOrder ();
+    stepsSinceReorder = 0;
+    if (useCpuBackend) {
+        return;
+    }
+
+    glGenBuffers (1, &orderBuffer);
+    glGenTextures (1, &orderTexture);
+    glGenTextures (1, &reorderTexture);
+    glBindBuffer (GL_TEXTURE_BUFFER, orderBuffer);
+    glBindTexture (GL_TEXTURE_BUFFER, orderTexture);
+    glTexBuffer (GL_TEXTURE_BUFFER, GL_R32UI, orderBuffer);
+    glBindTexture (GL_TEXTURE_BUFFER, 0);
+    glBindBuffer (GL_TEXTURE_BUFFER, 0);
+}
+
+void releaseReorder ()
+{
+    delete mortonOrder;
+    mortonOrder = nullptr;
+    if (useCpuBackend) {
+        return;
+    }
+
+    glDeleteTextures (1, &reorderTexture);
+    glDeleteTextures (1, &orderTexture);
+    glDeleteBuffers (1, &orderBuffer);
+    reorderTexture = 0;
+    orderTexture = 0;
+    orderBuffer = 0;
+
+    // others may share the CPU-backend's pool, only the own one goes
+    if (reorderOwnsThreadPool) {
+        delete threadPool;
+        threadPool = nullptr;
+        reorderOwnsThreadPool = false;
+    }
+    updateQualityLimits ();
+}
+
+// sorts the vbo's particles along a Morton-curve, the positions are read
+// back for that, but the permutation itself is a transform-feedback pass
+void reorderBuffer ()
+{
+    GLint maxTexels = 0;
+    glGetIntegerv (GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+    size_t texelsPerParticle = bytesPerParticle () / 4;
+    if (numParticles > (size_t) maxTexels / texelsPerParticle) {
+        std::cout << "Too many particles for a buffer-texture, not "
+                  << "reordering them anymore" << std::endl;
+        releaseReorder ();
+        return;
+    }
+
+    GLsizeiptr size = particleBufferSize (numParticles);
+    waitForNewestState ();
+    glBindBuffer (GL_ARRAY_BUFFER, vbo);
+    const void* mapped = glMapBufferRange (GL_ARRAY_BUFFER,
+                                           0,
+                                           size,
+                                           GL_MAP_READ_BIT);
+    if (!mapped) {
+        glBindBuffer (GL_ARRAY_BUFFER, 0);
+        return;
+    }
+    if (particleLayout == PackedLayout) {
+        mortonOrder->sortPacked (*threadPool,
+                                 (const uint16_t*) mapped,
+                                 numParticles);
+    } else {
+        mortonOrder->sortFloats (*threadPool,
+                                 (const float*) mapped,
+                                 numParticles,
+                                 15.0f);
+    }
+    glUnmapBuffer (GL_ARRAY_BUFFER);
+    glBindBuffer (GL_ARRAY_BUFFER, 0);
+
+    const std::vector<uint32_t>& order = mortonOrder->order ();
+    glBindBuffer (GL_TEXTURE_BUFFER, orderBuffer);
+    glBufferData (GL_TEXTURE_BUFFER,
+                  (GLsizeiptr) (order.size () * sizeof (uint32_t)),
+                  order.data (),
+                  GL_STREAM_DRAW);
+    glBindBuffer (GL_TEXTURE_BUFFER, 0);
+
+    // the vbo moves through the ring of state-buffers, so the view on the
+    // particles is attached anew every time
+    glUseProgram (reorderProgram ());
+    glBindTexture (GL_TEXTURE_BUFFER, reorderTexture);
+    glTexBuffer (GL_TEXTURE_BUFFER,
+                 particleLayout == PackedLayout ? GL_R32UI : GL_R32F,
+                 vbo);
+    glActiveTexture (GL_TEXTURE1);
+    glBindTexture (GL_TEXTURE_BUFFER, orderTexture);
+    glActiveTexture (GL_TEXTURE0);
+
+    glEnable (GL_RASTERIZER_DISCARD);
+    bindFeedbackTarget (tbo);
+    glBeginTransformFeedback (GL_POINTS);
+    glDrawArrays (GL_POINTS, 0, (GLsizei) numParticles);
+    glEndTransformFeedback ();
+    unbindFeedbackTarget ();
+    glDisable (GL_RASTERIZER_DISCARD);
+    glBindTexture (GL_TEXTURE_BUFFER, 0);
+    glActiveTexture (GL_TEXTURE1);
+    glBindTexture (GL_TEXTURE_BUFFER, 0);
+    glActiveTexture (GL_TEXTURE0);
+
+    advanceState ();
+}
+
+// every reorderInterval steps the particles get sorted along a Morton-curve,
+// so ones close in space are close in memory for the vertex-fetch and caches
+void reorderParticles (unsigned int steps)
+{
+    if (!mortonOrder) {
+        return;
+    }
+
+    stepsSinceReorder += steps;
+    if (stepsSinceReorder < reorderInterval) {
+        return;
+    }
+    stepsSinceReorder = 0;
+
+    TraceScope trace ("reorderParticles");
+    if (useCpuBackend) {
+        mortonOrder->apply (*threadPool, &cpuParticles, 15.0f);
+        return;
+    }
+
+    GpuTraceScope gpuTrace ("reorderParticles");
+    reorderBuffer ();
+}
+
+void releaseParticles ()
+{
+    releaseVertexArrays ();
+    releaseBodyTextures ();
+    glDeleteBuffers ((GLsizei) numStateBuffers, stateBuffers);
+    for (unsigned int i = 0; i < numStateBuffers; ++i) {
+        if (stateFences[i]) {
+            glDeleteSync (stateFences[i]);
+        }
+        stateBuffers[i] = 0;
+        stateFences[i] = 0;
+    }
+    newestState = 0;
+    validStates = 0;
+    vbo = 0;
+    tbo = 0;
+    if (useCpuBackend) {
+        freeParticleArrays (&cpuParticles);
+    }
+}
+
+bool createParticleBuffers (size_t count)
+{
+    GLsizeiptr size = particleBufferSize (count);
+    if (count == 0 ||
+        (size_t) size / bytesPerParticle () != count) {
+        std::cout << "Invalid number of particles: " << count << std::endl;
+        return false;
+    }
+
+    // only some drivers tell how much is left, everybody else has to go
+    // through with it and report GL_OUT_OF_MEMORY afterwards
+    GLint available = availableVideoMemory ();
+    GLint needed = (GLint) (numStateBuffers * (size / 1024));
+    if (available > 0 && needed > available) {
+        std::cout << count << " particles need " << needed
+                  << " KiB of buffer-memory, but only " << available
+                  << " KiB are available" << std::endl;
+        return false;
+    }
+
+    // a failed glBufferData() leaves the buffer empty, unlike the GL-error
+    // that is already gone through checkGLError() in debug-builds
+    bool allocated = true;
+    for (unsigned int i = 0; i < numStateBuffers; ++i) {
+        stateBuffers[i] = createVBO (size, nullptr, GL_DYNAMIC_COPY);
+        GLint64 bufferSize = 0;
+        glBindBuffer (GL_ARRAY_BUFFER, stateBuffers[i]);
+        glGetBufferParameteri64v (GL_ARRAY_BUFFER,
+                                  GL_BUFFER_SIZE,
+                                  &bufferSize);
+        allocated = allocated && bufferSize == size;
+    }
+    glBindBuffer (GL_ARRAY_BUFFER, 0);
+    newestState = 0;
+    selectStates ();
+    if (!allocated) {
+        std::cout << "Out of buffer-memory for " << count << " particles ("
+                  << numStateBuffers * size << " bytes)" << std::endl;
+        return false;
+    }
+
+    if (useCpuBackend &&
+        !allocParticleArrays (&cpuParticles, count)) {
+        std::cout << "Failed to allocate CPU-particles" << std::endl;
+        return false;
+    }
+
+    numParticles = count;
+    createVertexArrays ();
+    updateMaxDecimation ();
+    seedParticles ();
+    if (!useCpuBackend) {
+        createBodyTextures ();
+    }
+    updateQualityLimits ();
+
+    return true;
+}
+
+// (re)creates and seeds all state-buffers for count particles, if
+// that fails the previous particle-count is restored
+bool setupParticles (size_t count)
+{
+    size_t previous = vbo ? numParticles : 0;
+
+    releaseParticles ();
+    if (createParticleBuffers (count)) {
+        return true;
+    }
 
-// particle-drawing vertex- and fragment-shader
-const GLchar* vShaderSrc = GLSL(
-    in vec3 aPosition;
-    in vec3 aVelocity;
-    in float aDistance;
+    releaseParticles ();
+    if (previous && previous != count && createParticleBuffers (previous)) {
+        std::cout << "Keeping " << previous << " particles" << std::endl;
+    }
 
-    uniform mat4 uPersp;
-    uniform vec3 uEye;
-    uniform vec3 uAim;
-    uniform vec3 uUp;
-    uniform vec3 uTranslate;
-    uniform vec3 uAngles;
+    return false;
+}
 
-    out float vOpacity;
+// peak resident set size of this process in KiB (Linux reports ru_maxrss
+// in KiB already)
+long peakRssKiB ()
+{
+    struct rusage usage;
+    if (getrusage (RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
 
-    mat4 rot (vec3 angles)
-    {
-        vec3 rad = radians (angles);
-        vec3 c = cos (rad);
-        vec3 s = sin (rad);
+    return usage.ru_maxrss;
+}
 
-        mat4 matX = mat4 (vec4 (1.0, 0.0, 0.0, 0.0),
-                          vec4 (0.0, c.x, s.x, 0.0),
-                          vec4 (0.0,-s.x, c.x, 0.0),
-                          vec4 (0.0, 0.0, 0.0, 1.0));
+// seconds holds the wall-clock time of each repetition, the median of them is
+// reported as it's least affected by a single hiccup of the machine
+// needs a current GL-context, the captures are copies of the vbo
+void createRecorder ()
+{
+    if (!recordFile) {
+        return;
+    }
 
-        mat4 matY = mat4 (vec4 (c.y, 0.0,-s.y, 0.0),
-                          vec4 (0.0, 1.0, 0.0, 0.0),
-                          vec4 (s.y, 0.0, c.y, 0.0),
-                          vec4 (0.0, 0.0, 0.0, 1.0));
+    recorder = new TrajectoryRecorder ();
+    if (!recorder->open (recordFile, recordInterval, 15.0f, recordDelta)) {
+        delete recorder;
+        recorder = nullptr;
+    }
+}
 
-        mat4 matZ = mat4 (vec4 (c.z,  s.z, 0.0, 0.0),
-                          vec4 (-s.z, c.z, 0.0, 0.0),
-                          vec4 ( 0.0, 0.0, 1.0, 0.0),
-                          vec4 ( 0.0, 0.0, 0.0, 1.0));
+void releaseRecorder ()
+{
+    delete recorder;
+    recorder = nullptr;
+}
 
-        return matZ * matY * matX;
+// call whenever the vbo advanced by steps
+void recordTrajectory (unsigned int steps)
+{
+    if (recorder) {
+        recorder->stepped (vbo,
+                           numParticles,
+                           bytesPerParticle (),
+                           particleLayout == PackedLayout,
+                           steps);
     }
+}
 
-    mat4 trans (vec3 t)
-    {
-        mat4 mat = mat4 (vec4 (1.0, 0.0, 0.0, 0.0),
-                         vec4 (0.0, 1.0, 0.0, 0.0),
-                         vec4 (0.0, 0.0, 1.0, 0.0),
-                         vec4 (t.x, t.y, t.z, 1.0));
-        return mat;
+// writes the current state to filename, from the vbo or in headless-mode of
+// the CPU-backend (no GL at all) straight from its arrays
+bool saveCheckpoint (const char* filename, int width, int height)
+{
+    // only the particles the quality-controller kept simulating are current
+    size_t count = activeParticleCount ();
+    CheckpointHeader header;
+    std::memset (&header, 0, sizeof (header));
+    header.layout = particleLayout;
+    header.numParticles = count;
+    header.bytesPerParticle = (uint32_t) bytesPerParticle ();
+    header.stepCount = stepCount;
+    header.timeStep = timeStep;
+    header.blackHoleMass = blackHoleMass;
+    header.blackHolePosition[0] = 30.0f * (mouseX / width) - 15.0f;
+    header.blackHolePosition[1] = 30.0f * (mouseY / height) - 15.0f;
+    std::copy (angles, angles + 3, header.angles);
+
+    Checkpoint checkpoint;
+    if (!checkpoint.create (filename, header)) {
+        return false;
     }
 
-    mat4 lookAt (vec3 eye, vec3 aim, vec3 up)
-    {
-        vec3 f = normalize (aim - eye);
-        vec3 s = normalize (cross (f, up));
-        vec3 u = cross (s, f);
-        mat4 view = mat4 (vec4 (s.x, u.x, -f.x, 0.0),
-                          vec4 (s.y, u.y, -f.y, 0.0),
-                          vec4 (s.z, u.z, -f.z, 0.0),
-                          vec4 (0.0, 0.0, 0.0, 1.0));
-        return view;
+    bool success = true;
+    if (vbo) {
+        success = checkpoint.download (vbo);
+    } else {
+        fromParticleArrays (*threadPool,
+                            cpuParticles,
+                            (GLfloat*) checkpoint.particles ());
+    }
+    success = checkpoint.close () && success;
+    if (success) {
+        std::cout << "Saved " << count << " particles to " << filename
+                  << std::endl;
     }
 
-    void main()
-    {
-        mat4 view = lookAt (uEye, uAim, uUp);
-        mat4 model = trans (uTranslate) * rot (uAngles);
-        gl_Position = uPersp * view * model * vec4 (aPosition, 1.0);
-        gl_PointSize = 0.5;
-        vOpacity = length (aVelocity);
+    return success;
+}
+
+// only reads the header, so layout and particle-count are known before any
+// shader-program or buffer gets created
+bool peekCheckpoint (const char* filename)
+{
+    Checkpoint checkpoint;
+    if (!checkpoint.open (filename)) {
+        return false;
     }
-);
 
-const GLchar* fShaderSrc = GLSL(
-    uniform int uUseOpacity;
-    in float vOpacity;
-    void main()
-    {
-        if (uUseOpacity == 1) {
-            gl_FragColor = vec4 (.85, .85, .85, clamp (vOpacity, .0, 1.));
-        } else {
-            gl_FragColor = vec4 (.85, .85, .85, 1.);
-        }
+    const CheckpointHeader& header = checkpoint.header ();
+    if (header.layout != FloatLayout && header.layout != PackedLayout) {
+        std::cout << filename << " has an unknown layout" << std::endl;
+        return false;
     }
-);
+    particleLayout = (ParticleLayout) header.layout;
+    numParticles = (size_t) header.numParticles;
 
-// particle-gravity vertex-shader
-const GLchar* particleGravitySrc = GLSL(
-    in vec3 aPosition;
-    in vec3 aVelocity;
-    in float aDistance;
+    return true;
+}
 
-    out vec3 vPosition;
-    out vec3 vVelocity;
-    out float vDistance;
+// replaces particles and simulation-state by the ones in filename, buffers
+// are recreated if the particle-count differs
+bool restoreCheckpoint (const char* filename, int width, int height)
+{
+    Checkpoint checkpoint;
+    if (!checkpoint.open (filename)) {
+        return false;
+    }
 
-    uniform mat4 uPersp;
-    uniform vec3 uEye;
-    uniform vec3 uAim;
-    uniform vec3 uUp;
-    uniform vec3 uTranslate;
-    uniform vec3 uAngles;
+    const CheckpointHeader& header = checkpoint.header ();
+    if (header.layout != (uint32_t) particleLayout ||
+        header.bytesPerParticle != bytesPerParticle ()) {
+        std::cout << filename << " was written with another layout than the "
+                  << layoutName () << "-layout, restart with --restore "
+                  << filename << std::endl;
+        return false;
+    }
 
-    uniform vec3 uBlackHolePosition;
-    uniform float uTimeStep;
-    uniform float uBlackHoleMass;
-    uniform vec3 uLimits;
+    if (vbo && header.numParticles != numParticles &&
+        !setupParticles ((size_t) header.numParticles)) {
+        return false;
+    }
+    if (!vbo && cpuParticles.count != header.numParticles) {
+        std::cout << filename << " holds " << header.numParticles
+                  << " instead of " << cpuParticles.count << " particles"
+                  << std::endl;
+        return false;
+    }
 
-    mat4 rot (vec3 angles)
-    {
-        vec3 rad = radians (angles);
-        vec3 c = cos (rad);
-        vec3 s = sin (rad);
+    if (vbo) {
+        checkpoint.upload (vbo);
+        restartStates ();
+    }
+    if (useCpuBackend) {
+        toParticleArrays (*threadPool,
+                          (const GLfloat*) checkpoint.particles (),
+                          &cpuParticles);
+    }
 
-        mat4 matX = mat4 (vec4 (1.0, 0.0, 0.0, 0.0),
-                          vec4 (0.0, c.x, s.x, 0.0),
-                          vec4 (0.0,-s.x, c.x, 0.0),
-                          vec4 (0.0, 0.0, 0.0, 1.0));
+    stepCount = header.stepCount;
+    timeStep = header.timeStep;
+    blackHoleMass = header.blackHoleMass;
+    mouseX = (header.blackHolePosition[0] + 15.0f) / 30.0f * width;
+    mouseY = (header.blackHolePosition[1] + 15.0f) / 30.0f * height;
+    std::copy (header.angles, header.angles + 3, angles);
 
-        mat4 matY = mat4 (vec4 (c.y, 0.0,-s.y, 0.0),
-                          vec4 (0.0, 1.0, 0.0, 0.0),
-                          vec4 (s.y, 0.0, c.y, 0.0),
-                          vec4 (0.0, 0.0, 0.0, 1.0));
+    std::cout << "Restored " << numParticles << " particles from " << filename
+              << std::endl;
 
-        mat4 matZ = mat4 (vec4 (c.z,  s.z, 0.0, 0.0),
-                          vec4 (-s.z, c.z, 0.0, 0.0),
-                          vec4 ( 0.0, 0.0, 1.0, 0.0),
-                          vec4 ( 0.0, 0.0, 0.0, 1.0));
+    return true;
+}
 
-        return matZ * matY * matX;
+void reportThroughput (const char* backend,
+                       unsigned int steps,
+                       std::vector<double> seconds)
+{
+    std::sort (seconds.begin (), seconds.end ());
+    double median = seconds.empty () ? 0.0 : seconds[seconds.size () / 2];
+    if (!seconds.empty () && seconds.size () % 2 == 0) {
+        median = .5 * (median + seconds[seconds.size () / 2 - 1]);
+    }
+    double stepsPerSec = median > 0.0 ? steps / median : 0.0;
+    double nsPerParticle = steps > 0 && numParticles > 0 ?
+                           1e9 * median / ((double) steps * numParticles) :
+                           0.0;
+    // every step reads and writes every particle once
+    double bytesMoved = 2.0 * steps * numParticles * bytesPerParticle ();
+    double bytesPerSec = median > 0.0 ? bytesMoved / median : 0.0;
+
+    if (jsonReport) {
+        std::cout << std::setprecision (9)
+                  << "{\"backend\": \"" << backend << "\", "
+                  << "\"layout\": \"" << layoutName () << "\", "
+                  << "\"bytesPerParticle\": " << bytesPerParticle () << ", "
+                  << "\"particles\": " << numParticles << ", "
+                  << "\"gravitySources\": " << gravitySources.size () << ", "
+                  << "\"bodies\": " << activeBodies << ", "
+                  << "\"reorderEvery\": " << reorderInterval << ", "
+                  << "\"seed\": " << particleSeed << ", "
+                  << "\"steps\": " << steps << ", "
+                  << "\"warmupSteps\": " << warmupSteps << ", "
+                  << "\"seconds\": [";
+        for (size_t i = 0; i < seconds.size (); ++i) {
+            std::cout << (i > 0 ? ", " : "") << seconds[i];
+        }
+        std::cout << "], "
+                  << "\"stepsPerSec\": " << stepsPerSec << ", "
+                  << "\"nsPerParticle\": " << nsPerParticle << ", "
+                  << "\"bytesMoved\": " << bytesMoved << ", "
+                  << "\"bytesPerSec\": " << bytesPerSec << ", "
+                  << "\"peakRssKiB\": " << peakRssKiB () << "}"
+                  << std::endl;
+        return;
     }
 
-    mat4 trans (vec3 t)
-    {
-        mat4 mat = mat4 (vec4 (1.0, 0.0, 0.0, 0.0),
-                         vec4 (0.0, 1.0, 0.0, 0.0),
-                         vec4 (0.0, 0.0, 1.0, 0.0),
-                         vec4 (t.x, t.y, t.z, 1.0));
-        return mat;
+    std::string reordered;
+    if (reorderInterval > 0) {
+        reordered = ", Morton-ordered every " +
+                    std::to_string (reorderInterval) + " steps";
     }
+    std::cout << "headless (" << backend << ", " << layoutName ()
+              << "-layout, " << bytesPerParticle () << " bytes/particle, "
+              << gravitySources.size () << " gravity-sources, "
+              << activeBodies << " massive bodies, seed " << particleSeed
+              << reordered << "): "
+              << steps << " steps of " << numParticles << " particles, "
+              << "median of " << seconds.size () << " run(s) "
+              << std::fixed << std::setprecision (3) << median << " s\n\t"
+              << stepsPerSec << " steps/sec\n\t"
+              << stepsPerSec * numParticles << " particles/sec\n\t"
+              << nsPerParticle << " ns/particle\n\t"
+              << bytesPerSec / (1024.0 * 1024.0 * 1024.0) << " GiB/sec\n\t"
+              << peakRssKiB () / 1024.0 << " MiB peak RSS"
+              << std::endl;
+}
 
-    mat4 lookAt (vec3 eye, vec3 aim, vec3 up)
-    {
-        vec3 f = normalize (aim - eye);
-        vec3 s = normalize (cross (f, up));
-        vec3 u = cross (s, f);
-        mat4 view = mat4 (vec4 (s.x, u.x, -f.x, 0.0),
-                          vec4 (s.y, u.y, -f.y, 0.0),
-                          vec4 (s.z, u.z, -f.z, 0.0),
-                          vec4 (0.0, 0.0, 0.0, 1.0));
-        return view;
+// the CPU-backend needs no OpenGL at all, so this works without any driver
+int runHeadlessCpu (unsigned int steps)
+{
+    createCpuBackend ();
+    if (!allocParticleArrays (&cpuParticles, numParticles)) {
+        std::cout << "Failed to allocate " << numParticles << " particles"
+                  << std::endl;
+        releaseCpuBackend ();
+        return 7;
     }
+    seedParticleArrays (*threadPool, &cpuParticles, particleSeed, 15.0f);
 
-    void main() {
-        vec3 blackHolePos = vec4 (rot (uAngles) * vec4 (uBlackHolePosition, 1.)).xyz;
-        vec3 p = blackHolePos - aPosition;
-        float g = 0.0000000000667384;
-        float particleMass = 1000.0;
-        float k = g * particleMass * uBlackHoleMass;
-        float dist = length (p);
-        float d = dist * dist;
+    if (restoreFile &&
+        !restoreCheckpoint (restoreFile, WIN_WIDTH, WIN_HEIGHT)) {
+        freeParticleArrays (&cpuParticles);
+        releaseCpuBackend ();
+        return 9;
+    }
+    createReorder ();
 
-        vDistance = dist;
-        vec3 v = blackHolePos - aPosition;
-        vec3 f = k * normalize (v) / d;
+    // warm-up, lets the thread-pool spin up and Barnes-Hut size its tree
+    GravityParams params;
+    gravityParams (WIN_WIDTH, WIN_HEIGHT, &params);
+    for (unsigned int step = 0; step < warmupSteps; ++step) {
+        stepCpuBackend (params);
+    }
 
-        vec3 a = particleMass * f;
-        vec3 newVelocity = a + aVelocity;
-        vec3 tmp = .475 * (aVelocity + newVelocity);
-        vPosition = aPosition + tmp * uTimeStep;
-        vVelocity = tmp;
-        if (vPosition.x <= -uLimits.x ||
-            vPosition.x >= uLimits.x ||
-            vPosition.y <= -uLimits.y ||
-            vPosition.y >= uLimits.y ||
-            vPosition.z <= -uLimits.z ||
-            vPosition.z >= uLimits.z) {
-            vVelocity = 0.1 * tmp;
-            if (vPosition.x <= -uLimits.x ) {
-                vPosition.x = uLimits.x;
-            } else if (vPosition.x >= uLimits.x) {
-                vPosition.x = -uLimits.x;
-            }
-            if (vPosition.y <= -uLimits.y) {
-                vPosition.y = uLimits.y;
-            } else if (vPosition.y >= uLimits.y) {
-                vPosition.y = -uLimits.y;
-            }
-            if (vPosition.z <= -uLimits.z) {
-                vPosition.z = uLimits.z;
-            } else if (vPosition.z >= uLimits.z) {
-                vPosition.z = -uLimits.z;
-            }
+    std::vector<double> seconds;
+    for (unsigned int run = 0; run < repetitions; ++run) {
+        auto start = std::chrono::steady_clock::now ();
+        for (unsigned int step = 0; step < steps; ++step) {
+            stepCpuBackend (params);
+            reorderParticles (1);
         }
-        gl_Position = vec4 (0.0, 0.0, 0.0, 0.0);
+        auto end = std::chrono::steady_clock::now ();
+        std::chrono::duration<double> elapsed = end - start;
+        seconds.push_back (elapsed.count ());
     }
-);
 
-void updateFeedbackBuffer (GLuint program, int width, int height, float* persp)
+    reportThroughput (barnesHut ? "barnes-hut" : "cpu", steps, seconds);
+    stopTrace ();
+
+    stepCount += warmupSteps + repetitions * steps;
+    if (checkpointFile) {
+        saveCheckpoint (checkpointFile, WIN_WIDTH, WIN_HEIGHT);
+    }
+
+    releaseReorder ();
+    freeParticleArrays (&cpuParticles);
+    releaseCpuBackend ();
+
+    return 0;
+}
+
+// advance the simulation as fast as possible without any window or drawing,
+// meant for throughput-measurements and batch-runs on GPU-less machines
+int runHeadless (unsigned int steps)
 {
-    glUseProgram (program);
-    glUniform1f (uTimeStep, (GLfloat) lastFrameTick / 100000.0f);
-    glUniform3f (uBlackHolePosition,
-                 30.0f * (mouseX / width) - 15.0f,
-                 30.0f * (mouseY / height) - 15.0f,
-                 .0f);
-    glUniform3f (uLimits, 15.0f, 15.0f, 15.0f);
-    glUniform1f (uBlackHoleMass, blackHoleMass);
-
-    glUniformMatrix4fv (uPerspFeedback, 1, GL_FALSE, persp);
-    glUniform3fv (uAnglesFeedback, 1, angles);
-    glUniform3fv (uEyeFeedback, 1, eye);
-    glUniform3fv (uAimFeedback, 1, aim);
-    glUniform3fv (uUpFeedback, 1, up);
-    glUniform3fv (uTranslateFeedback, 1, translate);
+    if (useCpuBackend) {
+        return runHeadlessCpu (steps);
+    }
 
-    glEnable (GL_RASTERIZER_DISCARD);
-    glBindBuffer (GL_ARRAY_BUFFER, vbo);
-    glEnableVertexAttribArray (PositionAttr);
-    glEnableVertexAttribArray (VelocityAttr);
+    if (!createHeadlessContext ()) {
+        return 5;
+    }
 
-    GLchar* offset = 0;
-    glVertexAttribPointer (PositionAttr,
-                           3,
-                           GL_FLOAT,
-                           GL_FALSE,
-                           NUM_FLOATS_PER_VERTEX * sizeof (GLfloat),
-                           offset);
-    glVertexAttribPointer (VelocityAttr,
-                           3,
-                           GL_FLOAT,
-                           GL_FALSE,
-                           NUM_FLOATS_PER_VERTEX * sizeof (GLfloat),
-                           3 * sizeof (GLfloat) + offset);
-    glVertexAttribPointer (DistanceAttr,
-                           1,
-                           GL_FLOAT,
-                           GL_FALSE,
-                           NUM_FLOATS_PER_VERTEX * sizeof (GLfloat),
-                           6 * sizeof (GLfloat) + offset);
+    // GLEW >= 2.0 reports a missing GLX-display for an EGL-context, but by
+    // then it already resolved all GL entry-points we need
+    GLenum success = glewInit ();
+    if (success != GLEW_OK && success != GLEW_ERROR_NO_GLX_DISPLAY) {
+        std::cout << "OpenGL initialization failed: "
+                  << glewGetErrorString (success) << std::endl;
+        destroyHeadlessContext ();
+        return 6;
+    }
 
-    glBindBufferBase (GL_TRANSFORM_FEEDBACK_BUFFER, 0, tbo);
-    glBeginTransformFeedback (GL_POINTS);
-    glDrawArrays (GL_POINTS, 0, NUM_PARTICLES);
-    glEndTransformFeedback ();
-    glBindBuffer (GL_ARRAY_BUFFER, 0);
-    glDisableVertexAttribArray (PositionAttr);
-    glDisableVertexAttribArray (VelocityAttr);
-    glDisable (GL_RASTERIZER_DISCARD);
+    if (!jsonReport) {
+        std::cout << "OpenGL-renderer:\n\t" << glGetString (GL_RENDERER)
+                  << "\nOpenGL-version:\n\t" << glGetString (GL_VERSION)
+                  << "\n" << std::endl;
+    }
+    startGpuTrace ();
+
+    // a surfaceless context has no default framebuffer, without a complete
+    // one bound every draw-call fails even with GL_RASTERIZER_DISCARD enabled
+    GLuint fbo = 0;
+    GLuint rbo = 0;
+    glGenRenderbuffers (1, &rbo);
+    glBindRenderbuffer (GL_RENDERBUFFER, rbo);
+    glRenderbufferStorage (GL_RENDERBUFFER, GL_RGBA8, 1, 1);
+    glGenFramebuffers (1, &fbo);
+    glBindFramebuffer (GL_FRAMEBUFFER, fbo);
+    glFramebufferRenderbuffer (GL_FRAMEBUFFER,
+                               GL_COLOR_ATTACHMENT0,
+                               GL_RENDERBUFFER,
+                               rbo);
+
+    createProgramCache ();
+    createFrameUniforms ();
+    createGravitySources ();
+    updateFrameUniforms (WIN_WIDTH, WIN_HEIGHT, nullptr);
+    if (!setupParticles (numParticles)) {
+        releaseGravitySources ();
+        releaseFrameUniforms ();
+        releasePrograms ();
+        glDeleteFramebuffers (1, &fbo);
+        glDeleteRenderbuffers (1, &rbo);
+        destroyHeadlessContext ();
+        return 8;
+    }
 
-    std::swap (vbo, tbo);
+    if (restoreFile &&
+        !restoreCheckpoint (restoreFile, WIN_WIDTH, WIN_HEIGHT)) {
+        releaseParticles ();
+        releaseGravitySources ();
+        releaseFrameUniforms ();
+        releasePrograms ();
+        glDeleteFramebuffers (1, &fbo);
+        glDeleteRenderbuffers (1, &rbo);
+        destroyHeadlessContext ();
+        return 9;
+    }
 
-    glFlush ();
-}
+    // nothing moves the camera or the black-hole, one upload for all steps
+    updateFrameUniforms (WIN_WIDTH, WIN_HEIGHT, nullptr);
+    createRecorder ();
+    createReorder ();
 
-void initGL (SDL_Window* window, int width, int height, float* persp)
-{
-    if (!window) {
-        return;
+    // the options can't change, so neither does the variant
+    GLuint feedbackProg = feedbackProgram ();
+
+    // warm-up, lets the driver finish any deferred shader-compilation
+    for (unsigned int step = 0; step < warmupSteps; ++step) {
+        updateFeedbackBuffer (feedbackProg);
+    }
+    glFinish ();
+
+    std::vector<double> seconds;
+    for (unsigned int run = 0; run < repetitions; ++run) {
+        auto start = std::chrono::steady_clock::now ();
+        for (unsigned int step = 0; step < steps; ++step) {
+            updateFeedbackBuffer (feedbackProg);
+            reorderParticles (1);
+            recordTrajectory (1);
+            collectGpuTrace ();
+        }
+        glFinish ();
+        auto end = std::chrono::steady_clock::now ();
+        std::chrono::duration<double> elapsed = end - start;
+        seconds.push_back (elapsed.count ());
     }
 
-    dumpGLInfo (); // dumps to stdout when compiled without -mwindows under Win
+    reportThroughput ("gpu", steps, seconds);
+    stopTrace ();
 
-    glClearColor (BG_COLOR, 1.0);
-    //glViewport (0, 0, width, height);
-    //ortho (0.0, width, height, 0.0, Z_NEAR, Z_FAR, persp);
+    stepCount += warmupSteps + repetitions * steps;
+    if (checkpointFile) {
+        saveCheckpoint (checkpointFile, WIN_WIDTH, WIN_HEIGHT);
+    }
 
-    // setup proper GL-blending
-    glEnable (GL_BLEND);
-    glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glBlendEquation (GL_FUNC_ADD);
-    glEnable (GL_PROGRAM_POINT_SIZE);
+    releaseRecorder ();
+    releaseReorder ();
+    releaseParticles ();
+    releaseGravitySources ();
+    releaseFrameUniforms ();
+    releasePrograms ();
+    glDeleteFramebuffers (1, &fbo);
+    glDeleteRenderbuffers (1, &rbo);
+    destroyHeadlessContext ();
 
-    perspective (FOV, (GLfloat) width / (GLfloat) height, Z_NEAR, Z_FAR, persp);
+    return 0;
 }
 
-void resizeGL (SDL_Window* window, int width, int height, float* persp)
+// the README explains each of them in more detail
+void printUsage (const char* program)
 {
-    if (!window) {
-        return;
+    std::cout << "Usage: " << program << " [OPACITY] [OPTION]...\n"
+              << "  --headless STEPS, --warmup N, --repeat N, --json\n"
+              << "  --backend gpu|cpu|barnes-hut, --threads N, "
+              << "--cpu-kernel scalar|avx2|avx512\n"
+              << "  --theta T, --nbody-mass M, --bodies M\n"
+              << "  --layout float|packed, --bounds wrap|reflect|none, "
+              << "--reorder N\n"
+              << "  --particles N, --seed N, --sources N, "
+              << "--sources-file FILE\n"
+              << "  --time-step DT, --step-rate N, --max-substeps N\n"
+              << "  --state-buffers N, --frame-budget MS, --lod D, "
+              << "--accumulate SCALE\n"
+              << "  --trace FILE, --checkpoint FILE, --restore FILE\n"
+              << "  --record FILE, --record-every N, --record-delta\n"
+              << "  --shader-cache DIR, --no-shader-cache" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    bool headless = false;
+    unsigned int headlessSteps = 0;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg (argv[i]);
+        if (arg == "--headless" && i + 1 < argc) {
+            headless = true;
+            headlessSteps = (unsigned int) atoi (argv[++i]);
+        } else if (arg == "--warmup" && i + 1 < argc) {
+            warmupSteps = (unsigned int) atoi (argv[++i]);
+        } else if (arg == "--repeat" && i + 1 < argc) {
+            repetitions = std::max (atoi (argv[++i]), 1);
+        } else if (arg == "--json") {
+            jsonReport = true;
+        } else if (arg == "--backend" && i + 1 < argc) {
+            std::string backend (argv[++i]);
+            useBarnesHut = backend == "barnes-hut";
+            useCpuBackend = backend == "cpu" || useBarnesHut;
+        } else if (arg == "--theta" && i + 1 < argc) {
+            theta = (GLfloat) atof (argv[++i]);
+        } else if (arg == "--nbody-mass" && i + 1 < argc) {
+            nbodyMass = (GLfloat) atof (argv[++i]);
+        } else if (arg == "--layout" && i + 1 < argc) {
+            std::string layout (argv[++i]);
+            if (layout == "packed") {
+                particleLayout = PackedLayout;
+            } else if (layout != "float") {
+                std::cout << "Unknown layout " << layout << std::endl;
+                return 7;
+            }
+        } else if (arg == "--bounds" && i + 1 < argc) {
+            std::string bounds (argv[++i]);
+            if (bounds == "reflect") {
+                boundsMode = ReflectBounds;
+            } else if (bounds == "none") {
+                boundsMode = NoBounds;
+            } else if (bounds != "wrap") {
+                std::cout << "Unknown bounds " << bounds << std::endl;
+                return 7;
+            }
+        } else if (arg == "--reorder" && i + 1 < argc) {
+            reorderInterval = (unsigned int) atoi (argv[++i]);
+        } else if (arg == "--state-buffers" && i + 1 < argc) {
+            numStateBuffers = (unsigned int) atoi (argv[++i]);
+            numStateBuffers = std::max (numStateBuffers, 2u);
+            numStateBuffers = std::min (numStateBuffers,
+                                        (unsigned int) MAX_STATE_BUFFERS);
+        } else if (arg == "--frame-budget" && i + 1 < argc) {
+            frameBudget = atof (argv[++i]);
+        } else if (arg == "--accumulate" && i + 1 < argc) {
+            accumulationScale = (GLfloat) atof (argv[++i]);
+        } else if (arg == "--lod" && i + 1 < argc) {
+            lodDensity = (GLfloat) atof (argv[++i]);
+        } else if (arg == "--particles" && i + 1 < argc) {
+            numParticles = (size_t) strtoull (argv[++i], nullptr, 10);
+        } else if (arg == "--time-step" && i + 1 < argc) {
+            timeStep = (GLfloat) atof (argv[++i]);
+        } else if (arg == "--step-rate" && i + 1 < argc) {
+            stepRate = (unsigned int) atoi (argv[++i]);
+        } else if (arg == "--max-substeps" && i + 1 < argc) {
+            maxSubSteps = (unsigned int) atoi (argv[++i]);
+        } else if (arg == "--sources" && i + 1 < argc) {
+            randomGravitySources ((size_t) strtoull (argv[++i], nullptr, 10),
+                                  15.0f,
+                                  BLACK_HOLE_MASS,
+                                  gravitySources);
+        } else if (arg == "--sources-file" && i + 1 < argc) {
+            if (!loadGravitySources (argv[++i], gravitySources)) {
+                return 7;
+            }
+        } else if (arg == "--bodies" && i + 1 < argc) {
+            numBodies = (size_t) strtoull (argv[++i], nullptr, 10);
+        } else if (arg == "--trace" && i + 1 < argc) {
+            if (!startTrace (argv[++i])) {
+                return 7;
+            }
+        } else if (arg == "--checkpoint" && i + 1 < argc) {
+            checkpointFile = argv[++i];
+        } else if (arg == "--restore" && i + 1 < argc) {
+            restoreFile = argv[++i];
+        } else if (arg == "--record" && i + 1 < argc) {
+            recordFile = argv[++i];
+        } else if (arg == "--record-every" && i + 1 < argc) {
+            recordInterval = std::max (atoi (argv[++i]), 1);
+        } else if (arg == "--record-delta") {
+            recordDelta = true;
+        } else if (arg == "--shader-cache" && i + 1 < argc) {
+            shaderCacheDir = argv[++i];
+        } else if (arg == "--no-shader-cache") {
+            shaderCacheDir = nullptr;
+        } else if (arg == "--seed" && i + 1 < argc) {
+            particleSeed = (GLuint) strtoul (argv[++i], nullptr, 10);
+            seedGiven = true;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            numThreads = (unsigned int) atoi (argv[++i]);
+        } else if (arg == "--cpu-kernel" && i + 1 < argc) {
+            if (!setGravityKernel (argv[++i])) {
+                std::cout << "CPU-kernel " << argv[i] << " not supported"
+                          << std::endl;
+                return 7;
+            }
+        } else {
+            // a bare number is the opacity-flag of old, anything else is a
+            // typo or an option missing its value
+            char* end = nullptr;
+            long opacity = strtol (argv[i], &end, 10);
+            if (end == argv[i] || *end != '\0') {
+                std::cout << "Unknown option or missing value: " << arg
+                          << std::endl;
+                printUsage (argv[0]);
+                return 7;
+            }
+            useOpacity = (GLint) opacity;
+        }
     }
 
-    glViewport (0, 0, width, height);
+    // the same seed every reset, so SPACE brings back the initial state
+    if (!seedGiven) {
+        particleSeed = std::random_device () ();
+    }
 
-    //ortho (0.0, width, height, 0.0, Z_NEAR, Z_FAR, persp);
-    perspective (FOV, (GLfloat) width / (GLfloat) height, Z_NEAR, Z_FAR, persp);
-}
+    if (restoreFile && !peekCheckpoint (restoreFile)) {
+        return 9;
+    }
 
-void drawGL (SDL_Window* window, GLuint program, float* persp, GLuint bufferId)
-{
-    // vbo, uniform, attrib
-    static unsigned int fps = 0;
-    static unsigned int lastTick = 0;
-    static unsigned int currentTick = 0;
+    // the CPU-backend interleaves its arrays straight into the float-layout
+    if (useCpuBackend && particleLayout == PackedLayout) {
+        std::cout << "The packed layout needs the GPU-backend, using float"
+                  << std::endl;
+        particleLayout = FloatLayout;
+    }
 
-    if (!window) {
-        return;
+    if (useCpuBackend && boundsMode != WrapBounds) {
+        std::cout << "--bounds needs the GPU-backend, using wrap" << std::endl;
+        boundsMode = WrapBounds;
     }
 
-    glClear (GL_COLOR_BUFFER_BIT);
-    glUseProgram (program);
-    glBindBuffer (GL_ARRAY_BUFFER, bufferId);
-    angles[0] += .3;
-    angles[1] += .2;
-    //angles[2] -= .35;
-    glUniform1i (uUseOpacity, useOpacity);
-    glUniform3fv (uAngles, 1, angles);
-    glUniform3fv (uTranslate, 1, translate);
-    glUniform3fv (uEye, 1, eye);
-    glUniform3fv (uAim, 1, aim);
-    glUniform3fv (uUp, 1, up);
-
-    glUniformMatrix4fv (uPersp, 1, GL_FALSE, persp);
-    glEnableVertexAttribArray (PositionAttr);
-    glEnableVertexAttribArray (VelocityAttr);
-    glEnableVertexAttribArray (DistanceAttr);
+    // packed positions are relative to the bounds, they'd get stuck there
+    if (particleLayout == PackedLayout && boundsMode == NoBounds) {
+        std::cout << "--bounds none needs the float layout, using wrap"
+                  << std::endl;
+        boundsMode = WrapBounds;
+    }
 
-    GLchar* offset = 0;
-    glVertexAttribPointer (PositionAttr,
-                           3,
-                           GL_FLOAT,
-                           GL_FALSE,
-                           NUM_FLOATS_PER_VERTEX * sizeof (GLfloat),
-                           offset);
-    glVertexAttribPointer (VelocityAttr,
-                           3,
-                           GL_FLOAT,
-                           GL_FALSE,
-                           NUM_FLOATS_PER_VERTEX * sizeof (GLfloat),
-                           3 * sizeof (GLfloat) + offset);
-    glVertexAttribPointer (DistanceAttr,
-                           1,
-                           GL_FLOAT,
-                           GL_FALSE,
-                           NUM_FLOATS_PER_VERTEX * sizeof (GLfloat),
-                           5 * sizeof (GLfloat) + offset);
+    if (useCpuBackend && !gravitySources.empty ()) {
+        std::cout << "Gravity-sources need the GPU-backend, ignoring them"
+                  << std::endl;
+        gravitySources.clear ();
+    }
 
-    glDrawArrays (GL_POINTS, 0, NUM_PARTICLES);
-    glDisableVertexAttribArray (PositionAttr);
-    glDisableVertexAttribArray (VelocityAttr);
-    glDisableVertexAttribArray (DistanceAttr);
-    glBindTexture (GL_TEXTURE_2D, 0);
-    glBindBuffer (GL_ARRAY_BUFFER, 0);
-    SDL_GL_SwapWindow (window);
+    if (useCpuBackend && numBodies > 0) {
+        std::cout << "--bodies needs the GPU-backend, the CPU-backend's n-body "
+                  << "mode is --backend barnes-hut" << std::endl;
+        numBodies = 0;
+    }
 
-    fps++;
-    currentTick = SDL_GetTicks ();
+    // both identify particles by their index
+    if (reorderInterval > 0 && numBodies > 0) {
+        std::cout << "--reorder would change which particles are the "
+                  << "--bodies, ignoring it" << std::endl;
+        reorderInterval = 0;
+    }
+    if (reorderInterval > 0 && recordFile) {
+        std::cout << "--reorder would scramble the recorded trajectories, "
+                  << "ignoring it" << std::endl;
+        reorderInterval = 0;
+    }
 
-    if (currentTick - lastTick > 1000)
-    {
-        std::stringstream title;
-        title << WIN_TITLE << " - " << fps << " fps";
-        std::string str (title.str ());
-        SDL_SetWindowTitle (window, str.c_str ());
-        fps = 0;
-        lastTick = currentTick;
+    if (headless && useCpuBackend && recordFile) {
+        std::cout << "Recording trajectories needs OpenGL, the headless "
+                  << "CPU-backend ignores --record" << std::endl;
+        recordFile = nullptr;
+    }
+
+    // nothing gets drawn headless, so there's nothing to overlap with
+    if (headless) {
+        numStateBuffers = 2;
+        return runHeadless (headlessSteps);
     }
-    lastFrameTick = currentTick;
-}
 
-int main(int argc, char* argv[]) {
     // initialize SDL
     int result = 0;
     result = SDL_Init (SDL_INIT_VIDEO);
@@ -530,168 +2572,247 @@ int main(int argc, char* argv[]) {
                                   NULL);
     }
 
-    // create vertex-only shader-program
-    GLuint feedbackProg = createShaderProgram (particleGravitySrc, NULL, false);
-    glBindAttribLocation (feedbackProg, PositionAttr, "aPosition");
-    glBindAttribLocation (feedbackProg, VelocityAttr, "aVelocity");
-    glBindAttribLocation (feedbackProg, DistanceAttr, "aDistance");
+    startGpuTrace ();
+    createProgramCache ();
+    createFrameUniforms ();
+    createGravitySources ();
+    updateFrameUniforms (WIN_WIDTH, WIN_HEIGHT, nullptr);
 
-    const GLchar* feedbackVaryings[] = {"vPosition", "vVelocity", "vDistance"};
-    glTransformFeedbackVaryings (feedbackProg,
-                                 3,
-                                 feedbackVaryings,
-                                 GL_INTERLEAVED_ATTRIBS);
-
-    linkShaderProgram (feedbackProg);
-    glUseProgram (feedbackProg);
+    if (useCpuBackend) {
+        createCpuBackend ();
+    }
 
     // Create input VBO, vertex format and upload inital data
-    GLfloat* data = (GLfloat*) std::calloc (MAX_ELEMENTS, sizeof (GLfloat));
-
-    std::random_device rand;
-    std::mt19937 generator (rand ());
-    std::uniform_real_distribution<float> distributedX (-15, 15);
-    std::uniform_real_distribution<float> distributedY (-15, 15);
-    std::uniform_real_distribution<float> distributedZ (-15, 15);
-    for (int i = 0; i < MAX_ELEMENTS; i += NUM_FLOATS_PER_VERTEX) {
-        data[i]   = distributedX (generator);
-        data[i+1] = distributedY (generator);
-        data[i+2] = distributedZ (generator);
-        data[i+3] = 0.0;
-        data[i+4] = 0.0;
-        data[i+5] = 0.0;
-        data[i+6] = 0.0;
-    }
-
-	vbo = createVBO (MAX_ELEMENTS * sizeof (GLfloat), data, GL_DYNAMIC_COPY);
-	tbo = createVBO (MAX_ELEMENTS * sizeof (GLfloat), nullptr, GL_DYNAMIC_COPY);
-
-    glUseProgram (feedbackProg);
-    glEnableVertexAttribArray (PositionAttr);
-    glEnableVertexAttribArray (VelocityAttr);
-    glEnableVertexAttribArray (DistanceAttr);
+    if (!setupParticles (numParticles)) {
+        SDL_ShowSimpleMessageBox (SDL_MESSAGEBOX_ERROR,
+                                  "Error",
+                                  "Not enough memory for the particles",
+                                  NULL);
+        releaseGravitySources ();
+        releaseFrameUniforms ();
+        releasePrograms ();
+        releaseCpuBackend ();
+        SDL_GL_DeleteContext (context);
+        SDL_DestroyWindow (window);
+        IMG_Quit ();
+        SDL_Quit ();
+        return 8;
+    }
 
-    // provide uniform values
-    uBlackHolePosition = glGetUniformLocation (feedbackProg,
-                                               "uBlackHolePosition");
-
-    uTimeStep = glGetUniformLocation (feedbackProg, "uTimeStep");
-    uLimits = glGetUniformLocation (feedbackProg, "uLimits");
-    uBlackHoleMass = glGetUniformLocation (feedbackProg, "uBlackHoleMass");
-    uPerspFeedback = glGetUniformLocation (feedbackProg, "uPersp");
-    uAnglesFeedback = glGetUniformLocation (feedbackProg, "uAngles");
-    uEyeFeedback = glGetUniformLocation (feedbackProg, "uEye");
-    uAimFeedback = glGetUniformLocation (feedbackProg, "uAim");
-    uUpFeedback = glGetUniformLocation (feedbackProg, "uUp");
-    uTranslateFeedback = glGetUniformLocation (feedbackProg, "uTranslate");
-    glUniform1f (uTimeStep, 0.0);
-    glUniform2f (uBlackHolePosition, mouseX, mouseY);
-    //glUniform2f (uLimits, (GLfloat) WIN_WIDTH, (GLfloat) WIN_HEIGHT);
-    glUniform1f (uBlackHoleMass, blackHoleMass);
-    GLuint particleProg = createShaderProgram (vShaderSrc, fShaderSrc, true);
-    glBindAttribLocation (particleProg, PositionAttr, "aPosition");
-    glBindAttribLocation (particleProg, VelocityAttr, "aVelocity");
-    glBindAttribLocation (particleProg, DistanceAttr, "aDistance");
-    uPersp = glGetUniformLocation (particleProg, "uPersp");
-    uAngles = glGetUniformLocation (particleProg, "uAngles");
-    uEye = glGetUniformLocation (particleProg, "uEye");
-    uAim = glGetUniformLocation (particleProg, "uAim");
-    uUp = glGetUniformLocation (particleProg, "uUp");
-    uTranslate = glGetUniformLocation (particleProg, "uTranslate");
-    uUseOpacity = glGetUniformLocation (particleProg, "uUseOpacity");
-
-    if (argc == 2) {
-        useOpacity = atoi (argv[1]);
+    if (restoreFile) {
+        restoreCheckpoint (restoreFile, WIN_WIDTH, WIN_HEIGHT);
+    }
+    if (!checkpointFile) {
+        checkpointFile = DEFAULT_CHECKPOINT_FILE;
+    }
+
+    if (stepRate == 0) {
+        stepRate = DEFAULT_STEP_RATE;
+    }
+    if (maxSubSteps == 0) {
+        maxSubSteps = 1;
     }
 
+    createRecorder ();
+    createReorder ();
+    createQualityController ();
+
     float persp[16];
     initGL (window, WIN_WIDTH, WIN_HEIGHT, persp);
 
+    // the simulation advances in fixed steps of timeStep at stepRate steps
+    // per second of wall-clock time, independent of the frame-rate
+    double stepInterval = 1000.0 / stepRate;
+    double accumulator = 0.0;
+    unsigned int lastTick = SDL_GetTicks ();
+
     // event-loop
     bool running = true;
     while (running) {
-        SDL_Event event;
-        while (SDL_PollEvent (&event)) {
-            switch (event.type) {
-                case SDL_KEYUP:
-                    if (event.key.keysym.sym == SDLK_ESCAPE) {
-                        running = false;
-                    }
-                    if (event.key.keysym.sym == SDLK_SPACE) {
-                        updateVBO (vbo,
-                                   MAX_ELEMENTS * sizeof (GLfloat),
-                                   data,
-                                   GL_DYNAMIC_COPY);
-                        updateVBO (tbo,
-                                   MAX_ELEMENTS * sizeof (GLfloat),
-                                   nullptr,
-                                   GL_DYNAMIC_COPY);
-                        blackHoleMass = 0.0;
-                    }
-                break;
-
-                case SDL_MOUSEMOTION:
-                    if (SDL_GetMouseState (NULL, NULL) &
-                        SDL_BUTTON (SDL_BUTTON_LEFT) || 
-                        SDL_GetMouseState (NULL, NULL) &
-                        SDL_BUTTON (SDL_BUTTON_RIGHT)) {
-                        mouseX = (GLfloat) event.motion.x;
-                        mouseY = (GLfloat) event.motion.y;
-                    }
-                break;
-
-                case SDL_MOUSEBUTTONDOWN:
-                    if (SDL_GetMouseState (NULL, NULL) &
-                        SDL_BUTTON (SDL_BUTTON_LEFT)) {
-                        mouseX = (GLfloat) event.button.x;
-                        mouseY = (GLfloat) event.button.y;
-                        blackHoleMass = BLACK_HOLE_MASS;
-                    }
-
-                    if (SDL_GetMouseState (NULL, NULL) &
-                        SDL_BUTTON (SDL_BUTTON_RIGHT)) {
-                        blackHoleMass = -0.25 * BLACK_HOLE_MASS;
-                    }
-
-                    if (SDL_GetMouseState (NULL, NULL) &
-                        SDL_BUTTON (SDL_BUTTON_MIDDLE)) {
-                        blackHoleMass = 0.0;
-                    }
-                break;
-
-                case SDL_WINDOWEVENT:
-                    if (event.window.event == SDL_WINDOWEVENT_CLOSE) {
-                        running = false;
-                    } else if (event.window.event == SDL_WINDOWEVENT_RESIZED) {
-                        resizeGL (window,
-                                  event.window.data1,
-                                  event.window.data2,
-                                  persp);
-                    }
-                break;
-
-                default:
-                break;
+        {
+            TraceScope trace ("SDL_PollEvent");
+            SDL_Event event;
+            while (SDL_PollEvent (&event)) {
+                switch (event.type) {
+                    case SDL_KEYUP:
+                        if (event.key.keysym.sym == SDLK_ESCAPE) {
+                            running = false;
+                        }
+                        if (event.key.keysym.sym == SDLK_SPACE) {
+                            seedParticles ();
+                            blackHoleMass = 0.0;
+                        }
+                        if (event.key.keysym.sym == SDLK_o) {
+                            useOpacity = !useOpacity;
+                        }
+                        if (event.key.keysym.sym == SDLK_b &&
+                            !useCpuBackend) {
+                            boundsMode = nextBoundsMode (boundsMode);
+                            std::cout << boundsName (boundsMode)
+                                      << " bounds" << std::endl;
+                        }
+                        if (event.key.keysym.sym == SDLK_F5) {
+                            int width = 0;
+                            int height = 0;
+                            SDL_GetWindowSize (window, &width, &height);
+                            saveCheckpoint (checkpointFile, width, height);
+                        }
+                        if (event.key.keysym.sym == SDLK_F9) {
+                            int width = 0;
+                            int height = 0;
+                            SDL_GetWindowSize (window, &width, &height);
+                            restoreCheckpoint (checkpointFile, width, height);
+                        }
+                        if (event.key.keysym.sym == SDLK_PAGEUP) {
+                            setupParticles (numParticles * 2);
+                            std::cout << numParticles << " particles"
+                                      << std::endl;
+                        }
+                        if (event.key.keysym.sym == SDLK_PAGEDOWN &&
+                            numParticles > 1) {
+                            setupParticles (numParticles / 2);
+                            std::cout << numParticles << " particles"
+                                      << std::endl;
+                        }
+                    break;
+
+                    case SDL_MOUSEMOTION:
+                        if (SDL_GetMouseState (NULL, NULL) &
+                            SDL_BUTTON (SDL_BUTTON_LEFT) || 
+                            SDL_GetMouseState (NULL, NULL) &
+                            SDL_BUTTON (SDL_BUTTON_RIGHT)) {
+                            mouseX = (GLfloat) event.motion.x;
+                            mouseY = (GLfloat) event.motion.y;
+                        }
+                    break;
+
+                    case SDL_MOUSEBUTTONDOWN:
+                        if (SDL_GetMouseState (NULL, NULL) &
+                            SDL_BUTTON (SDL_BUTTON_LEFT)) {
+                            mouseX = (GLfloat) event.button.x;
+                            mouseY = (GLfloat) event.button.y;
+                            blackHoleMass = BLACK_HOLE_MASS;
+                        }
+
+                        if (SDL_GetMouseState (NULL, NULL) &
+                            SDL_BUTTON (SDL_BUTTON_RIGHT)) {
+                            blackHoleMass = -0.25 * BLACK_HOLE_MASS;
+                        }
+
+                        if (SDL_GetMouseState (NULL, NULL) &
+                            SDL_BUTTON (SDL_BUTTON_MIDDLE)) {
+                            blackHoleMass = 0.0;
+                        }
+                    break;
+
+                    case SDL_WINDOWEVENT:
+                        if (event.window.event == SDL_WINDOWEVENT_CLOSE) {
+                            running = false;
+                        } else if (event.window.event ==
+                                   SDL_WINDOWEVENT_RESIZED) {
+                            resizeGL (window,
+                                      event.window.data1,
+                                      event.window.data2,
+                                      persp);
+                        }
+                    break;
+
+                    default:
+                    break;
+                }
             }
         }
 
         int width = 0;
         int height = 0;
         SDL_GetWindowSize (window, &width, &height);
-        updateFeedbackBuffer (feedbackProg, width, height, persp);
-        drawGL (window, particleProg, persp, vbo);
+
+        unsigned int tick = SDL_GetTicks ();
+        accumulator += tick - lastTick;
+        lastTick = tick;
+
+        // without a quality-controller it's all particles, drawn as --lod says
+        QualitySettings quality = {maxSubSteps, 0, 1};
+        if (qualityController) {
+            quality = qualityController->settings ();
+        }
+        size_t wasActive = activeParticleCount ();
+        activeParticles = quality.particles;
+        freezeParticles (activeParticleCount (), wasActive);
+
+        unsigned int subSteps = 0;
+        while (accumulator >= stepInterval && subSteps < quality.subSteps) {
+            accumulator -= stepInterval;
+            ++subSteps;
+        }
+
+        // one Frame-block for the sub-steps and the drawing of this frame
+        updateDecimation (width, height);
+        drawDecimation = std::max (drawDecimation, quality.decimation);
+        updateFrameUniforms (width, height, persp);
+
+        // the CPU-backend only needs to hand over the last of its sub-steps
+        auto stepStart = std::chrono::steady_clock::now ();
+        if (useCpuBackend) {
+            if (subSteps > 0) {
+                updateCpuSimulation (width, height, subSteps);
+                reorderParticles (subSteps);
+                recordTrajectory (subSteps);
+            }
+        } else {
+            // one query for all sub-steps, a timer only has a few of them
+            if (stepTimer && subSteps > 0) {
+                stepTimer->begin ();
+            }
+            for (unsigned int step = 0; step < subSteps; ++step) {
+                updateFeedbackBuffer (feedbackProgram ());
+                reorderParticles (1);
+                recordTrajectory (1);
+            }
+            if (stepTimer && subSteps > 0) {
+                stepTimer->end (subSteps);
+            }
+        }
+        if (qualityController && !stepTimer && subSteps > 0) {
+            qualityController->addSteps (millisecondsSince (stepStart),
+                                         subSteps);
+        }
+        stepCount += subSteps;
+
+        // can't keep up, rather run slower than real-time than spiral into
+        // ever more sub-steps per frame
+        if (subSteps == quality.subSteps) {
+            accumulator = 0.0;
+        }
+
+        drawGL (window, particleProgram (), drawState ());
+        collectGpuTrace ();
+        if (qualityController) {
+            pollQualityTimers ();
+            if (qualityController->endFrame (subSteps)) {
+                std::cout << qualityController->decision () << std::endl;
+            }
+        }
+        if (recorder) {
+            recorder->poll ();
+        }
     }
 
     // clean up
-    glDeleteBuffers (1, &vbo);
-    glDeleteBuffers (1, &tbo);
-    glDeleteProgram (feedbackProg);
-    glDeleteProgram (particleProg);
+    stopTrace ();
+    releaseQualityController ();
+    releaseAccumulation ();
+    releaseRecorder ();
+    releaseReorder ();
+    releaseParticles ();
+    releaseGravitySources ();
+    releaseFrameUniforms ();
+    releasePrograms ();
     SDL_GL_DeleteContext (context);
     SDL_DestroyWindow (window);
     IMG_Quit ();
     SDL_Quit ();
-    std::free (data);
+    releaseCpuBackend ();
 
     return 0;
 }
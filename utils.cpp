@@ -23,6 +23,8 @@
 //
 ////////////////////////////////////////////////////////////////////////////////
 
+#include <cstring>
+
 #include "utils.h"
 
 void frustum (float a,
@@ -108,6 +110,95 @@ void ortho (float left,
     out[15] = 1.0f;
 }
 
+// column-major 4x4 matrices like GL expects them, out must not alias a or b
+void multiply (const float* a, const float* b, float* out)
+{
+    assert (a && b && out);
+
+    for (int col = 0; col < 4; ++col) {
+        for (int row = 0; row < 4; ++row) {
+            out[col * 4 + row] = a[row]      * b[col * 4]     +
+                                 a[4 + row]  * b[col * 4 + 1] +
+                                 a[8 + row]  * b[col * 4 + 2] +
+                                 a[12 + row] * b[col * 4 + 3];
+        }
+    }
+}
+
+// same as rot() in the shaders, angles in degrees applied as Z * Y * X
+void rotate (float angleX, float angleY, float angleZ, float* out)
+{
+    assert (out);
+
+    float cx = cos (angleX * M_PI / 180.0f);
+    float sx = sin (angleX * M_PI / 180.0f);
+    float cy = cos (angleY * M_PI / 180.0f);
+    float sy = sin (angleY * M_PI / 180.0f);
+    float cz = cos (angleZ * M_PI / 180.0f);
+    float sz = sin (angleZ * M_PI / 180.0f);
+
+    float matX[16] = {1.0f, 0.0f, 0.0f, 0.0f,
+                      0.0f,   cx,   sx, 0.0f,
+                      0.0f,  -sx,   cx, 0.0f,
+                      0.0f, 0.0f, 0.0f, 1.0f};
+
+    float matY[16] = {  cy, 0.0f,  -sy, 0.0f,
+                      0.0f, 1.0f, 0.0f, 0.0f,
+                        sy, 0.0f,   cy, 0.0f,
+                      0.0f, 0.0f, 0.0f, 1.0f};
+
+    float matZ[16] = {  cz,   sz, 0.0f, 0.0f,
+                       -sz,   cz, 0.0f, 0.0f,
+                      0.0f, 0.0f, 1.0f, 0.0f,
+                      0.0f, 0.0f, 0.0f, 1.0f};
+
+    float matZY[16];
+    multiply (matZ, matY, matZY);
+    multiply (matZY, matX, out);
+}
+
+void translation (float x, float y, float z, float* out)
+{
+    assert (out);
+
+    float mat[16] = {1.0f, 0.0f, 0.0f, 0.0f,
+                     0.0f, 1.0f, 0.0f, 0.0f,
+                     0.0f, 0.0f, 1.0f, 0.0f,
+                        x,    y,    z, 1.0f};
+    std::memcpy (out, mat, sizeof (mat));
+}
+
+// view-matrix of a camera at eye looking at aim, like gluLookAt() but without
+// the translation by -eye (the shaders never had it either)
+void lookAt (const float* eye, const float* aim, const float* up, float* out)
+{
+    assert (eye && aim && up && out);
+
+    float f[3] = {aim[0] - eye[0], aim[1] - eye[1], aim[2] - eye[2]};
+    float length = std::sqrt (f[0] * f[0] + f[1] * f[1] + f[2] * f[2]);
+    for (int i = 0; i < 3; ++i) {
+        f[i] /= length;
+    }
+
+    float s[3] = {f[1] * up[2] - f[2] * up[1],
+                  f[2] * up[0] - f[0] * up[2],
+                  f[0] * up[1] - f[1] * up[0]};
+    length = std::sqrt (s[0] * s[0] + s[1] * s[1] + s[2] * s[2]);
+    for (int i = 0; i < 3; ++i) {
+        s[i] /= length;
+    }
+
+    float u[3] = {s[1] * f[2] - s[2] * f[1],
+                  s[2] * f[0] - s[0] * f[2],
+                  s[0] * f[1] - s[1] * f[0]};
+
+    float mat[16] = {s[0], u[0], -f[0], 0.0f,
+                     s[1], u[1], -f[1], 0.0f,
+                     s[2], u[2], -f[2], 0.0f,
+                     0.0f, 0.0f,  0.0f, 1.0f};
+    std::memcpy (out, mat, sizeof (mat));
+}
+
 void checkGLError (const char* func)
 {
 
@@ -242,6 +333,19 @@ GLuint createTexture (const char* filename)
     return texture;
 }
 
+// src with a "#define name value"-line per entry right behind its #version
+std::string shaderVariant (const char* src, const ShaderDefines& defines)
+{
+    std::stringstream lines;
+    for (const auto& define : defines) {
+        lines << "#define " << define.first << " " << define.second << "\n";
+    }
+
+    std::string variant (src);
+    variant.insert (variant.find ('\n') + 1, lines.str ());
+    return variant;
+}
+
 GLuint loadShader (const char *src, GLenum type)
 {
     checkGLError (nullptr);
@@ -406,3 +510,20 @@ void updateVBO (GLuint vbo, GLsizeiptr size, const GLvoid* data, GLenum usage)
     glBindBuffer (GL_ARRAY_BUFFER, 0);
     checkGLError ("glBindBuffer");
 }
+
+// free video-memory in KiB as reported by the driver, 0 if it doesn't tell
+GLint availableVideoMemory ()
+{
+    GLint available = 0;
+
+    if (GLEW_NVX_gpu_memory_info) {
+        glGetIntegerv (GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX,
+                       &available);
+    } else if (GLEW_ATI_meminfo) {
+        GLint info[4] = {0, 0, 0, 0};
+        glGetIntegerv (GL_VBO_FREE_MEMORY_ATI, info);
+        available = info[0];
+    }
+
+    return available;
+}
@@ -32,6 +32,9 @@
 #include <iterator>
 #include <cassert>
 #include <cmath>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include <SDL.h>
 #include <SDL_image.h>
@@ -39,6 +42,16 @@
 
 #define GLSL(src) "#version 130\n" #src
 
+// samplerBuffer and texelFetch() on it need GLSL 1.40 (OpenGL 3.1)
+#define GLSL140(src) "#version 140\n" #src
+
+// shader-code meant to be appended to a GLSL()-string, hence no #version
+#define GLSL_PART(src) #src
+
+// GLSL()-bodies end up on a single line, so they can't have preprocessor-
+// directives of their own, but they can use macros defined ahead of them
+typedef std::vector<std::pair<std::string, int>> ShaderDefines;
+
 void frustum (float a,
               float b,
               float c,
@@ -58,9 +71,14 @@ void ortho (float left,
             float nearVal,
             float farVal,
             float* out);
+void multiply (const float* a, const float* b, float* out);
+void rotate (float angleX, float angleY, float angleZ, float* out);
+void translation (float x, float y, float z, float* out);
+void lookAt (const float* eye, const float* aim, const float* up, float* out);
 void checkGLError (const char* func);
 void dumpGLInfo ();
 GLuint createTexture (const char* filename);
+std::string shaderVariant (const char* src, const ShaderDefines& defines);
 GLuint loadShader (const char *src, GLenum type);
 GLuint createShaderProgram (const char* vertexShaderSrc,
                             const char* fragmentShaderSrc,
@@ -68,5 +86,6 @@ GLuint createShaderProgram (const char* vertexShaderSrc,
 void linkShaderProgram (GLuint progId);
 GLuint createVBO (GLsizeiptr size, const GLvoid* data, GLenum usage);
 void updateVBO (GLuint vbo, GLsizeiptr size, const GLvoid* data, GLenum usage);
+GLint availableVideoMemory ();
 
 #endif // _UTILS_H